@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "chargen.h"
 #include "keyboard.h"
@@ -12,6 +13,9 @@
 #include "RP2040.h"
 #include "cmsis_compiler.h"
 #include "hardware/clocks.h"
+#include "hardware/dma.h"
+#include "hardware/interp.h"
+#include "hardware/irq.h"
 #include "hardware/structs/mpu.h"
 #include "hardware/watchdog.h"
 #include "pico.h"
@@ -20,113 +24,54 @@
 #include "pico/stdio/driver.h"
 #include "pico/stdlib.h"
 
-#include "vga_660x477_60.pio.h"
+#include "vga_modes.pio.h"
+#include "vga_modes.h"
 
 #include "lw_terminal_vt100.h"
+#include "scan_convert.h"
 #define DEBUG(...) ((void)0)
 
-int pixels_sm;
-
-#define WRITE_PIXDATA (pio0->txf[0] = pixels)
-#define FIFO_WAIT                                                              \
-    do { /* NOTHING */                                                         \
-    } while (pio_sm_get_tx_fifo_level(pio0, 0) > 2)
+_Static_assert(VIDEO_MAX_HEIGHT <= FB_HEIGHT_PIXEL,
+               "FB_HEIGHT_CHAR is too small for the tallest video mode");
 
-#define FB_WIDTH_CHAR (132)
-#define FB_HEIGHT_CHAR (53)
-#define CHAR_X (5)
-#define CHAR_Y (9)
-#define FB_HEIGHT_PIXEL (FB_HEIGHT_CHAR * CHAR_Y)
+int pixels_sm;
+int pixels_dma;
 
-#define ATTR_BASE 9
 #define BG_ATTR(x) ((x) << 11)
 #define FG_ATTR(x) ((x) << ATTR_BASE)
 
 #define MAKE_ATTR(fg, bg) (((fg) ^ (((bg)*9) & 073)) << ATTR_BASE)
 
+#define COUNT_OF(x) ((sizeof(x) / sizeof((x)[0])))
+
 struct lw_terminal_vt100 *vt100;
 
-// declaring this static breaks it (why?)
-void scan_convert(const uint32_t *restrict cptr32,
-                  const uint16_t *restrict cgptr,
-                  const uint16_t *restrict shade);
-void __not_in_flash_func(scan_convert)(const uint32_t *restrict cptr32,
-                                       const uint16_t *restrict cgptr,
-                                       const uint16_t *restrict shade) {
-#define READ_CHARDATA (ch = *cptr32++)
-#define ONE_CHAR(in_shift, op, out_shift)                                      \
-    do {                                                                       \
-        chardata = cgptr[(ch >> (in_shift)) & ((1 << ATTR_BASE) - 1)];         \
-        mask = shade[(ch >> (ATTR_BASE + (in_shift))) & 7];                    \
-        pixels op(shade[(ch >> (ATTR_BASE + 3 + (in_shift))) & 7] ^            \
-                  (chardata & mask)) out_shift;                                \
-    } while (0)
-
-    uint32_t ch;
-    uint16_t chardata, mask;
-    uint32_t pixels;
-
-#define SIX_CHARS                                                              \
-    do {                                                                       \
-        READ_CHARDATA;                                                         \
-        ONE_CHAR(0, =, << 20);                                                 \
-        ONE_CHAR(16, |=, << 10);                                               \
-        READ_CHARDATA;                                                         \
-        ONE_CHAR(0, |=, );                                                     \
-        WRITE_PIXDATA;                                                         \
-        ONE_CHAR(16, =, << 20);                                                \
-        READ_CHARDATA;                                                         \
-        ONE_CHAR(0, |=, << 10);                                                \
-        ONE_CHAR(16, |=, );                                                    \
-        WRITE_PIXDATA;                                                         \
-    } while (0)
-
-    SIX_CHARS;
-    SIX_CHARS;
-    SIX_CHARS;
-    FIFO_WAIT; /*  18 */
-
-    SIX_CHARS;
-    SIX_CHARS;
-    SIX_CHARS;
-    FIFO_WAIT; /*  36 */
-
-    SIX_CHARS;
-    SIX_CHARS;
-    SIX_CHARS;
-    FIFO_WAIT; /*  54 */
-
-    SIX_CHARS;
-    SIX_CHARS;
-    SIX_CHARS;
-    FIFO_WAIT; /*  72 */
-
-    SIX_CHARS;
-    SIX_CHARS;
-    SIX_CHARS;
-    FIFO_WAIT; /*  90 */
-
-    SIX_CHARS;
-    SIX_CHARS;
-    SIX_CHARS;
-    FIFO_WAIT; /* 108 */
-
-    SIX_CHARS;
-    SIX_CHARS;
-    SIX_CHARS;
-    FIFO_WAIT; /* 126 */
-
-    SIX_CHARS; /* 132 */
-}
-
-#define CHAR_COUNT (512)
 uint16_t chargen[CHAR_COUNT * CHAR_Y] = {
 #include "5x9.h"
 };
+uint16_t chargen_80[CHAR_COUNT * CHAR_Y] = {
+#include "8x9.h"
+};
+// The font drawn by each of scan_geometries
+// note: not in flash (referenced from core1 generator thread)
+static uint16_t *fonts[SCAN_GEOMETRIES] = {
+    [SCAN_132x5] = chargen,
+    [SCAN_80x8] = chargen_80,
+};
 
-_Static_assert(FB_WIDTH_CHAR % 6 == 0);
+// DECDLD soft font glyphs take the place of unused ones in every font
+#define SOFT_FONT_BASE (CHAR_COUNT - 128)
+_Static_assert(SOFT_FONT_BASE + LW_SOFT_GLYPHS <= CHAR_COUNT,
+               "the soft font doesn't fit in the fonts");
+
+// Core0 packs downloaded glyphs here for each font, and core1 copies them
+// into the fonts between frames, so that it never draws a half-loaded glyph
+// note: not in flash (referenced from core1 generator thread)
+static uint16_t soft_glyphs[SCAN_GEOMETRIES][CHAR_Y][LW_SOFT_GLYPHS];
+static volatile bool soft_glyphs_ready;
 
 lw_cell_t statusline[FB_WIDTH_CHAR];
+volatile uint8_t statusline_dirty;
 
 static int status_printf(const char *fmt, ...) {
     char buf[2 * FB_WIDTH_CHAR + 1];
@@ -147,6 +92,7 @@ static int status_printf(const char *fmt, ...) {
     while (j < FB_WIDTH_CHAR) {
         statusline[j++] = 32 | attr;
     }
+    statusline_dirty = 1;
     return n;
 }
 int scrnprintf(const char *fmt, ...) {
@@ -160,67 +106,562 @@ int scrnprintf(const char *fmt, ...) {
     return n;
 }
 
+// The index in video_modes of the mode being displayed
+int video_mode;
+// Its text rows, including the status line
 // note: not in flash (referenced from core1 generator thread)
-static uint16_t base_shade[] = {0,     0x554, 0xaa8, 0xffc, 0,     0x554,
-                                0xaa8, 0xffc, 0,     0,     0,     0,
-                                0xffc, 0xaa8, 0x554, 0x000, 0xffc, 0xaa8,
-                                0x554, 0x000, 0xffc, 0xffc, 0xffc, 0xffc};
+static volatile int video_rows;
 
 #if !STANDALONE
-static void setup_vga_hsync(PIO pio) {
-    uint offset = pio_add_program(pio, &vga_660x477_60_hsync_program);
+static int setup_vga_hsync(PIO pio, const video_mode_t *mode) {
+    uint offset = pio_add_program(pio, mode->hsync_program);
     uint sm = pio_claim_unused_sm(pio, true);
-    vga_660x477_60_hsync_program_init(pio, sm, offset, HSYNC_PIN);
+    mode->hsync_init(pio, sm, offset, HSYNC_PIN);
+    return sm;
 }
 
-static void setup_vga_vsync(PIO pio) {
-    uint offset = pio_add_program(pio, &vga_660x477_60_vsync_program);
+static int setup_vga_vsync(PIO pio, const video_mode_t *mode) {
+    uint offset = pio_add_program(pio, mode->vsync_program);
     uint sm = pio_claim_unused_sm(pio, true);
-    vga_660x477_60_vsync_program_init(pio, sm, offset, VSYNC_PIN);
+    mode->vsync_init(pio, sm, offset, VSYNC_PIN);
+    return sm;
 }
 
-static int setup_vga_pixels(PIO pio) {
-    uint offset = pio_add_program(pio, &vga_660x477_60_pixel_program);
+static int setup_vga_pixels(PIO pio, const video_mode_t *mode) {
+    uint offset = pio_add_program(pio, mode->pixel_program);
     uint sm = pio_claim_unused_sm(pio, true);
-    vga_660x477_60_pixel_program_init(pio, sm, offset, G0_PIN, 2);
+    mode->pixel_init(pio, sm, offset, G0_PIN, 2);
     return sm;
 }
 
-static void setup_vga(void) {
-    pixels_sm = setup_vga_pixels(pio0);
+#if RENDER_DMA
+static int setup_vga_dma(PIO pio, int sm) {
+    int chan = dma_claim_unused_channel(true);
+    dma_channel_config c = dma_channel_get_default_config(chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, pio_get_dreq(pio, sm, true));
+    dma_channel_configure(chan, &c, &pio->txf[sm], NULL, FB_WORDS_PER_LINE,
+                          false);
+    return chan;
+}
+#endif
+
+// The state machines running the video mode's programs
+static uint32_t vga_sm_mask;
+
+static void setup_vga(const video_mode_t *mode) {
+    pixels_sm = setup_vga_pixels(pio0, mode);
     assert(pixels_sm == 0);
-    setup_vga_vsync(pio0);
-    setup_vga_hsync(pio0);
+    vga_sm_mask = 1u << pixels_sm;
+    vga_sm_mask |= 1u << setup_vga_vsync(pio0, mode);
+    vga_sm_mask |= 1u << setup_vga_hsync(pio0, mode);
 }
 
-int frameno = 0;
+// Stop the video mode's state machines and unload their programs, so that
+// setup_vga can load another mode's
+static void teardown_vga(void) {
+    pio_set_sm_mask_enabled(pio0, vga_sm_mask, false);
+    for (uint sm = 0; sm < 4; sm++) {
+        if (vga_sm_mask & (1u << sm)) {
+            pio_sm_clear_fifos(pio0, sm);
+            pio_sm_unclaim(pio0, sm);
+        }
+    }
+    vga_sm_mask = 0;
+    pio_clear_instruction_memory(pio0);
+    // the vsync program may have raised its flags on the way out
+    for (uint irq = 0; irq <= VIDEO_VBLANK_IRQ; irq++) {
+        pio_interrupt_clear(pio0, irq);
+    }
+}
+
+#if RENDER_DMA
+static void __not_in_flash_func(send_scanline)(const uint32_t *buf) {
+    dma_channel_wait_for_finish_blocking(pixels_dma);
+    dma_channel_transfer_from_buffer_now(pixels_dma, buf, FB_WORDS_PER_LINE);
+}
+#else
+#define send_scanline(buf) ((void)0)
+#endif
+
+#if ROW_CACHE
+// Every scanline of every row stays rendered here. A row is converted again
+// only when it is dirty or the attribute table changes, otherwise the DMA
+// channel sends its cached scanlines as they are.
+static uint32_t row_cache[FB_HEIGHT_CHAR][CHAR_Y][FB_WORDS_PER_LINE];
+#define SCANLINE_BUF(row, j) (row_cache[row][j])
+
+static bool __not_in_flash_func(take_row_dirty)(int row, int rows) {
+    volatile uint8_t *flag =
+        row == rows - 1 ? &statusline_dirty : &vt100->dirty[row];
+    if (!*flag) {
+        return false;
+    }
+    // clear before rendering, so a write that lands mid-render marks the row
+    // again for the next frame
+    *flag = 0;
+    return true;
+}
+#elif RENDER_DMA
+// While the DMA channel feeds one buffer to the pixel FIFO, the next scanline
+// is rendered into the other.
+static uint32_t scanline_buf[2][FB_WORDS_PER_LINE];
+static int scanline_idx;
+#define SCANLINE_BUF(row, j) (scanline_buf[scanline_idx ^= 1])
+#else
+#define SCANLINE_BUF(row, j) (NULL)
+#endif
+
+// Counts frames; advanced by the vsync program's IRQ at the start of each
+// vertical blanking interval
+volatile int frameno = 0;
 int bell_frame_end = -1;
+
+static void __not_in_flash_func(vblank_isr)(void) {
+    pio_interrupt_clear(pio0, VIDEO_VBLANK_IRQ);
+    frameno += 1;
+}
+
+static void setup_vblank_irq(void) {
+    pio_set_irq0_source_enabled(pio0, pis_interrupt0 + VIDEO_VBLANK_IRQ,
+                                true);
+    irq_set_exclusive_handler(PIO0_IRQ_0, vblank_isr);
+    irq_set_enabled(PIO0_IRQ_0, true);
+}
+
+#if ROW_DECODE
+// The attributes of the row being rendered, decoded once for its 9 scanlines,
+// and again for the scanlines that draw its underline or strike-through
+static uint32_t row_attrs[FB_WIDTH_CHAR];
+static uint32_t line_attrs[FB_WIDTH_CHAR];
+#endif
+
+volatile render_stats_t render_stats;
+
+// Core1's SysTick free-runs down from 2^24 at the system clock, timing the
+// renderer
+static void setup_render_timer(void) {
+    SysTick->LOAD = SysTick_LOAD_RELOAD_Msk;
+    SysTick->VAL = 0;
+    SysTick->CTRL = SysTick_CTRL_CLKSOURCE_Msk | SysTick_CTRL_ENABLE_Msk;
+}
+
+static uint32_t __not_in_flash_func(cycles_since)(uint32_t start) {
+    return (start - SysTick->VAL) & SysTick_VAL_CURRENT_Msk;
+}
+
+// Rows of the other lw_line_sizes are drawn by the geometry's double-width
+// kernel, from the first half of their cells
+static inline scan_kernel_t *__not_in_flash_func(row_kernel)(
+    const scan_geometry_t *geom, int size) {
+    return size == LW_LINE_SINGLE ? geom->convert : geom->convert_double;
+}
+
+static inline int __not_in_flash_func(row_cells)(const scan_geometry_t *geom,
+                                                 int size) {
+    return size == LW_LINE_SINGLE ? geom->columns : geom->columns / 2;
+}
+
+// The glyph line shown on scanline j of a row; each half of a double-height
+// row shows half of the glyph lines twice. (No switch: its jump table would
+// be in flash.)
+static inline int __not_in_flash_func(row_glyph_line)(int size, int j) {
+    if (size == LW_LINE_DOUBLE_TOP) {
+        return j / 2;
+    }
+    if (size == LW_LINE_DOUBLE_BOTTOM) {
+        return (j + CHAR_Y) / 2;
+    }
+    return j;
+}
+
+// Copy a completed download into the fonts, at the start of a frame (about 2
+// scanlines' time, well within vertical blanking)
+static bool __not_in_flash_func(install_soft_glyphs)(void) {
+    if (!soft_glyphs_ready) {
+        return false;
+    }
+    for (int g = 0; g < SCAN_GEOMETRIES; g++) {
+        for (int j = 0; j < CHAR_Y; j++) {
+            uint16_t *glyph_line = &fonts[g][CHAR_COUNT * j + SOFT_FONT_BASE];
+            for (int i = 0; i < LW_SOFT_GLYPHS; i++) {
+                glyph_line[i] = soft_glyphs[g][j][i];
+            }
+        }
+    }
+    soft_glyphs_ready = false;
+    return true;
+}
+
+#if RENDER_DMA
+// Time a row of the cells the kernels are slowest on in every geometry and
+// line size, into the first scanline buffer, so that a build which can't keep
+// up shows at power-on. Writing the FIFO directly is paced by the display, so
+// it can't be timed this way.
+static void __not_in_flash_func(measure_render)(void) {
+    static uint32_t cells[FB_WIDTH_CHAR / 2];
+    for (int i = 0; i < FB_WIDTH_CHAR / 2; i++) {
+        cells[i] = 0xffffffff;
+    }
+    uint32_t worst = 0;
+    for (int g = 0; g < SCAN_GEOMETRIES; g++) {
+        const scan_geometry_t *geom = &scan_geometries[g];
+        for (int size = LW_LINE_SINGLE; size <= LW_LINE_DOUBLE_WIDTH; size++) {
+            for (int j = 0; j < CHAR_Y; j++) {
+                uint32_t start = SysTick->VAL;
+#if ROW_DECODE
+                // as on a row's first scanline
+                scan_decode_row(cells, attr_tables[0], row_attrs,
+                                row_cells(geom, size));
+                const uint32_t *cell_attrs = row_attrs;
+#else
+                const uint32_t *cell_attrs = attr_tables[0];
+#endif
+                row_kernel(geom, size)(cells, &fonts[g][CHAR_COUNT * j],
+                                       cell_attrs, SCANLINE_BUF(0, 0));
+                uint32_t busy = cycles_since(start);
+                if (busy > worst) {
+                    worst = busy;
+                }
+            }
+        }
+    }
+    render_stats.boot_scanline = worst;
+}
+#endif
+
+static struct lw_terminal_vt100_snapshot snapshot;
+// The emulator's screen changes, which core1 makes between frames: room for
+// a few frames' worth of text
+// note: not in flash (referenced from core1 generator thread)
+static struct lw_op vt100_ops[1024];
+_Static_assert(COUNT_OF(vt100_ops) > LW_OPS_PER_COMMIT,
+               "the op queue must hold a whole commit");
+
+// The cursor is drawn over the rendered screen rather than stored in it
+typedef struct {
+    // row is -1 while no cursor is shown
+    int row, col;
+    // in pixels, and from the first of the scanlines it covers to the last
+    int x, width, first_line;
+} cursor_overlay_t;
+
+static cursor_overlay_t __not_in_flash_func(get_cursor)(
+    int phase, const scan_geometry_t *geom) {
+    cursor_overlay_t cursor = {-1, 0, 0, 0, 0};
+    uint32_t pos = vt100->cursor;
+    unsigned style = vt100->cursor_style;
+    // DECSCUSR: odd styles blink, 1-2 are blocks, 3-4 underlines, 5-6 bars
+    if (pos == LW_CURSOR_HIDDEN || ((style & 1) && (phase & ATTR_BLINK_OFF))) {
+        return cursor;
+    }
+    cursor.row = LW_CURSOR_Y(pos);
+    cursor.col = LW_CURSOR_X(pos);
+    // twice as wide on double-width rows
+    int glyph_width = geom->glyph_width;
+    if (snapshot.line_size[cursor.row] != LW_LINE_SINGLE) {
+        glyph_width *= 2;
+    }
+    cursor.x = geom->margin + cursor.col * glyph_width;
+    cursor.width = style >= 5 ? 1 : glyph_width;
+    cursor.first_line = style == 3 || style == 4 ? CHAR_Y - 1 : 0;
+    return cursor;
+}
+
+#if ROW_CACHE
+static bool cursor_equal(const cursor_overlay_t *a, const cursor_overlay_t *b) {
+    return a->row == b->row && a->col == b->col && a->x == b->x &&
+           a->width == b->width && a->first_line == b->first_line;
+}
+#endif
+
+#if RENDER_DMA
+// Invert `width` pixels of a rendered scanline, starting `x` pixels in
+static void __not_in_flash_func(draw_cursor)(uint32_t *buf, int x, int width) {
+    for (int p = x; p < x + width; p++) {
+        buf[p / PIXELS_PER_WORD] ^= 3u << (30 - 2 * (p % PIXELS_PER_WORD));
+    }
+}
+#else
+// Without a scanline buffer to draw into, the cursor inverts its cell's
+// colors in a copy of its row
+#define CURSOR_ATTR BG_ATTR(7)
+static uint32_t cursor_line[FB_WIDTH_CHAR / 2];
+#endif
+
+// The lines of scrollback core1 shows above the screen, paged by
+// Shift+PgUp/PgDn; snapshot.scrollback is how many it did show, as there may
+// be fewer
+static volatile unsigned int scrollback;
+
+// To change video modes, core0 sets video_pause and waits for core1 to park
+// between frames and set video_parked. Core1 resumes in the new mode once
+// video_pause is cleared.
+static volatile bool video_pause, video_parked;
+
 __attribute__((noreturn, noinline)) static void
 __not_in_flash_func(core1_loop)(void) {
+    const lw_cell_t **lines = snapshot.lines;
+    int rows = video_rows;
+    int last_frameno = frameno;
+    // cleared while the pixel state machine waits for a mode's first frame
+    bool displaying = false;
+    // Smooth scrolling moves the scroll region up a scanline per frame,
+    // about 6 lines per second as on a VT100
+    unsigned int scroll_done = 0;
+    int scroll_shift = 0;
+#if ROW_CACHE
+    const uint32_t *last_attrs = NULL;
+    cursor_overlay_t last_cursor = {-1, 0, 0, 0, 0};
+    bool was_scrolling = false;
+    bool was_scrolled_back = false;
+#endif
+    const scan_geometry_t *geom = NULL;
+    const uint16_t *font = NULL;
+    const uint32_t txstall = 1u << (PIO_FDEBUG_TXSTALL_LSB + pixels_sm);
+    uint32_t worst_scanline = 0;
     while (true) {
-        uint16_t *shade_ptr = frameno & 0x20 ? base_shade : base_shade + 4;
+        // Start each frame at vertical blanking, with the row pointers of one
+        // complete scroll/margin update. Core1 is at most a scanline ahead of
+        // the display, so the blanking interval is enough to render row 0.
+        while (frameno == last_frameno) {
+            /* NOTHING */
+        }
+        last_frameno = frameno;
+        if (install_soft_glyphs()) {
+#if ROW_CACHE
+            // every row may show the new glyphs
+            last_attrs = NULL;
+#endif
+        }
+        if (video_pause) {
+            video_parked = true;
+            while (video_pause) {
+                /* NOTHING */
+            }
+            video_parked = false;
+            rows = video_rows;
+            // The new mode's vsync program starts by signalling vertical
+            // blanking, so its first frame is rendered in time: start over,
+            // with every row rendered afresh
+            geom = NULL;
+            displaying = false;
+            continue;
+        }
+        // The pixel state machine only stalls when a scanline is late, except
+        // while it waits for a mode's first frame
+        if (pio0->fdebug & txstall) {
+            pio0->fdebug = txstall;
+            if (displaying) {
+                render_stats.underruns++;
+            }
+        }
+        if (snapshot.scroll_pending && ++scroll_shift == CHAR_Y) {
+            scroll_shift = 0;
+            vt100->scroll_done = ++scroll_done;
+        }
+        // make the screen changes core0 has queued since the last frame
+        lw_terminal_vt100_apply(vt100);
+        // smooth scrolls aren't animated while the scrollback is shown
+        unsigned int back = scrollback;
+        if (back) {
+            scroll_done = vt100->shown.scroll_count;
+            vt100->scroll_done = scroll_done;
+            scroll_shift = 0;
+        }
+        lw_terminal_vt100_snapshot(vt100, &snapshot, scroll_done, back);
+        // the emulator's screen is one row short of the mode's, but may still
+        // be the old mode's size while core0 is changing modes
+        lines[rows - 1] = statusline;
+        snapshot.line_size[rows - 1] = LW_LINE_SINGLE;
+        bool scrolling = snapshot.scroll_pending != 0;
+
+        // DECCOLM switches the geometry along with the emulator's width
+        bool geometry_changed =
+            geom == NULL || geom->columns != (int)snapshot.width;
+        if (geometry_changed) {
+            geom = scan_find_geometry(snapshot.width);
+            font = fonts[geom - scan_geometries];
+            scan_attr_tables(geom);
+            // time the new geometry on its own
+            worst_scanline = 0;
+        }
+
+        int phase = frameno & 0x20 ? 0 : ATTR_BLINK_OFF;
         if (bell_frame_end > frameno) {
-            shade_ptr += 12;
+            phase |= ATTR_BELL;
+        }
+        const uint32_t *attrs = attr_tables[phase];
+        // the attribute table for each glyph line
+        const uint32_t *glyph_line_attrs[CHAR_Y];
+        for (int line = 0; line < CHAR_Y; line++) {
+            int line_attr = scan_line_attr(line);
+            glyph_line_attrs[line] =
+                line_attr ? attr_tables[phase | line_attr >> 3] : attrs;
         }
-        for (int row = 0; row < FB_HEIGHT_CHAR; row++) {
-            uint32_t *chardata =
-                row == FB_HEIGHT_CHAR - 1
-                    ? (uint32_t *)statusline
-                    : (uint32_t *)lw_terminal_vt100_getline(vt100, row);
+        cursor_overlay_t cursor = get_cursor(phase, geom);
+        bool scrolled_back = snapshot.scrollback != 0;
+        if (scrolling || scrolled_back) {
+            cursor.row = -1;
+        }
+#if ROW_CACHE
+        // any change moves the rows shown along with the scrollback, so while
+        // it is shown (and once more after) they are all rendered afresh
+        bool attrs_changed = attrs != last_attrs || geometry_changed ||
+                             scrolled_back || was_scrolled_back;
+        last_attrs = attrs;
+        was_scrolled_back = scrolled_back;
+        // re-render the rows the cursor left and entered
+        int cursor_rows[2] = {-1, -1};
+        if (!cursor_equal(&cursor, &last_cursor)) {
+            cursor_rows[0] = last_cursor.row;
+            cursor_rows[1] = cursor.row;
+            last_cursor = cursor;
+        }
+        // and the scroll region while it moves, and once it has stopped
+        bool region_moved = scrolling || was_scrolling;
+        was_scrolling = scrolling;
+#endif
+        for (int row = 0; row < rows; row++) {
+            bool in_region =
+                row >= snapshot.margin_top && row <= snapshot.margin_bottom;
+#if ROW_CACHE
+            if (!take_row_dirty(row, rows) && !attrs_changed &&
+                !(in_region && region_moved) && row != cursor_rows[0] &&
+                row != cursor_rows[1]) {
+                for (int j = 0; j < CHAR_Y; j++) {
+                    send_scanline(row_cache[row][j]);
+                }
+                continue;
+            }
+#endif
+            // Rows of the scroll region are drawn `shift` scanlines up, so
+            // their last scanlines come from the row below
+            int shift = in_region ? scroll_shift : 0;
+            const uint32_t *chardata = (const uint32_t *)lines[row];
+            int size = snapshot.line_size[row];
+            const uint32_t *below = NULL;
+            int below_size = LW_LINE_SINGLE;
+            if (shift) {
+                bool last = row == snapshot.margin_bottom;
+                below = (const uint32_t *)(last ? snapshot.incoming
+                                                : lines[row + 1]);
+                below_size =
+                    last ? snapshot.incoming_size : snapshot.line_size[row + 1];
+            }
+            scan_kernel_t *convert = row_kernel(geom, size);
+            uint32_t start = SysTick->VAL;
+#if ROW_DECODE
+            uint32_t row_used = scan_decode_row(chardata, attrs, row_attrs,
+                                                row_cells(geom, size));
+#endif
+#if !RENDER_DMA
+            if (row == cursor.row) {
+                for (int i = 0; i < geom->columns / 2; i++) {
+                    cursor_line[i] = chardata[i];
+                }
+                ((lw_cell_t *)cursor_line)[cursor.col] ^= CURSOR_ATTR;
+            }
+#endif
             for (int j = 0; j < CHAR_Y; j++) {
-                scan_convert(chardata, &chargen[CHAR_COUNT * j], shade_ptr);
+                int line = j + shift;
+                if (line >= CHAR_Y) {
+                    line -= CHAR_Y;
+                    if (line == 0) {
+                        chardata = below;
+                        size = below_size;
+                        convert = row_kernel(geom, size);
+#if ROW_DECODE
+                        row_used = scan_decode_row(chardata, attrs, row_attrs,
+                                                   row_cells(geom, size));
+#endif
+                    }
+                }
+                int glyph_line = row_glyph_line(size, line);
+                const uint16_t *cgptr = &font[CHAR_COUNT * glyph_line];
+#if ROW_DECODE
+                const uint32_t *cell_attrs = row_attrs;
+                if (row_used & scan_line_attr(glyph_line)) {
+                    scan_decode_row(chardata, glyph_line_attrs[glyph_line],
+                                    line_attrs, row_cells(geom, size));
+                    cell_attrs = line_attrs;
+                }
+#else
+                const uint32_t *cell_attrs = glyph_line_attrs[glyph_line];
+#endif
+                uint32_t *buf = SCANLINE_BUF(row, j);
+                bool on_cursor = row == cursor.row && j >= cursor.first_line;
+#if RENDER_DMA
+                convert(chardata, cgptr, cell_attrs, buf);
+                if (on_cursor) {
+                    draw_cursor(buf, cursor.x, cursor.width);
+                }
+#else
+                convert(on_cursor ? cursor_line : chardata, cgptr, cell_attrs,
+                        buf);
+#endif
+                // the first scanline includes decoding the row; without
+                // RENDER_DMA, this includes waiting for the FIFO
+                uint32_t busy = cycles_since(start);
+                if (busy > worst_scanline) {
+                    worst_scanline = busy;
+                }
+                send_scanline(buf);
+                start = SysTick->VAL;
             }
         }
-
-        frameno += 1;
+        render_stats.worst_scanline = worst_scanline;
+        render_stats.frames++;
+        displaying = true;
+        if (frameno != last_frameno) {
+            render_stats.missed_frames++;
+        }
     }
 }
 
 static void visual_bell(void *_) { bell_frame_end = frameno + 15; }
 
+// Core0 packs each glyph of a DECDLD download as mkfont.py would, stretching
+// or squeezing its columns across each font's cells
+static void load_glyph(void *_, int glyph, const uint16_t *rows, int width) {
+    // core1 hasn't taken the previous download yet
+    while (soft_glyphs_ready) {
+        /* NOTHING */
+    }
+    for (int g = 0; g < SCAN_GEOMETRIES; g++) {
+        int cell_width = scan_geometries[g].glyph_width;
+        int glyph_shift = 16 - 2 * cell_width < 2 ? 16 - 2 * cell_width : 2;
+        for (int j = 0; j < CHAR_Y; j++) {
+            uint16_t bits = 0;
+            for (int x = 0; x < cell_width; x++) {
+                int column = (x * width + width - 1) / cell_width;
+                if (rows[j] & (1 << column)) {
+                    bits |= 3 << (2 * (cell_width - 1 - x));
+                }
+            }
+            soft_glyphs[g][j][glyph - SOFT_FONT_BASE] = bits << glyph_shift;
+        }
+    }
+}
+
+static void soft_font_loaded(void *_) { soft_glyphs_ready = true; }
+
 static __attribute__((noreturn, noinline)) void
 __not_in_flash_func(core1_entry)(void) {
-    setup_vga();
+    scan_convert_init();
+    setup_render_timer();
+    render_stats.scanline_budget = video_modes[video_mode].line_cycles;
+#if RENDER_DMA
+    measure_render();
+#endif
+    render_stats.ready = true;
+    setup_vga(&video_modes[video_mode]);
+#if RENDER_DMA
+    pixels_dma = setup_vga_dma(pio0, pixels_sm);
+#endif
+    setup_vblank_irq();
 
     // Turn off flash access. After this, it will hard fault. Better than
     // messing up CIRCUITPY.
@@ -247,12 +688,16 @@ static lw_cell_t char_attr(void *user_data, const struct lw_parsed_attr *attr) {
     }
     if (attr->bold)
         fg = 3;
-    if (attr->blink)
-        fg ^= 4;
+    lw_cell_t effects = (attr->strike ? FG_ATTR(ATTR_STRIKE) : 0) |
+                        (attr->underline ? FG_ATTR(ATTR_UNDERLINE) : 0);
+    // the background has only 2 bits: inverse text blinks its glyph, in the
+    // field's color
     if (attr->inverse) {
-        return MAKE_ATTR(bg, fg);
+        return MAKE_ATTR(attr->blink ? bg ^ 4 : bg, fg) | effects;
     }
-    return MAKE_ATTR(fg, bg);
+    if (attr->blink)
+        fg ^= 4;
+    return MAKE_ATTR(fg, bg) | effects;
 }
 
 queue_t keyboard_queue;
@@ -268,7 +713,6 @@ static void reset_cpu(void) {
 
 int current_port;
 
-#define COUNT_OF(x) ((sizeof(x) / sizeof((x)[0])))
 
 uint baudrates[] = {300, 1200, 2400, 9600, 19200, 38400, 115200};
 #define N_BAUDRATES (COUNT_OF(baudrates))
@@ -457,6 +901,50 @@ static void switch_port(void) {
     port_activate();
 }
 
+// Display the next of video_modes: take the display away from core1, load the
+// mode's programs into pio0, and re-clock the system (along with the UART and
+// keyboard that are clocked from it) if the mode needs it. The emulator's
+// height changes too, so this is only called from the main loop, between
+// buffers of input; the key just sets video_switch_pending.
+static bool video_switch_pending;
+static void switch_video_mode(void) {
+    int next = (video_mode + 1) % VIDEO_MODES;
+    const video_mode_t *mode = &video_modes[next];
+    int rows = mode->visible_height / CHAR_Y;
+    // while core1 still runs, as it animates any pending smooth scrolls
+    lw_terminal_vt100_set_height(vt100, rows - 1);
+
+    video_pause = true;
+    while (!video_parked) {
+        /* NOTHING */
+    }
+    teardown_vga();
+    if (mode->sys_clock_khz != video_modes[video_mode].sys_clock_khz) {
+        set_sys_clock_khz(mode->sys_clock_khz, false);
+        port_activate();
+        keyboard_clock_changed();
+    }
+    video_mode = next;
+    video_rows = rows;
+    render_stats.scanline_budget = mode->line_cycles;
+    setup_vga(mode);
+    video_pause = false;
+
+    refresh_status();
+}
+
+// Page through the scrollback from where core1 shows it, which stops at the
+// oldest line, so that paging back never runs ahead of it
+static void page_scrollback(bool up) {
+    unsigned int shown = snapshot.scrollback;
+    unsigned int page = vt100->height - 1;
+    if (up) {
+        scrollback = shown + page;
+    } else {
+        scrollback = shown > page ? shown - page : 0;
+    }
+}
+
 static int stdio_kbd_in_chars(char *buf, int length) {
     int rc = 0;
     int code;
@@ -474,11 +962,22 @@ static int stdio_kbd_in_chars(char *buf, int length) {
             case CMD_SWITCH_PORT:
                 switch_port();
                 break;
+            case CMD_SWITCH_VIDEO:
+                video_switch_pending = true;
+                break;
+            case CMD_SCROLLBACK_UP:
+                page_scrollback(true);
+                break;
+            case CMD_SCROLLBACK_DOWN:
+                page_scrollback(false);
+                break;
             case CMD_REBOOT:
                 reset_cpu();
             }
             continue;
         }
+        // typing returns to the screen
+        scrollback = 0;
         *buf++ = code;
         length--;
         rc++;
@@ -495,6 +994,15 @@ static int kbd_getc_nonblocking(void) {
     return c;
 }
 
+// Core0 waits here while core1 animates smooth scrolls; keep passing keys
+// through meanwhile, so that e.g. ^S and ^C still work
+static void scroll_wait(void *_) {
+    int c = kbd_getc_nonblocking();
+    if (c != EOF) {
+        port_putc(c);
+    }
+}
+
 #if 0
 static stdio_driver_t stdio_kbd = {
     .in_chars = stdio_kbd_in_chars,
@@ -604,10 +1112,28 @@ static int map_unicode(void *user_data, int n, lw_cell_t *attr) {
     return '?';
 }
 
+// SRAM left over for the USB stack, stdio and the UARTs' buffers once the
+// scrollback has taken the rest of the heap
+#define HEAP_RESERVE (16 * 1024)
+
+// Scrollback lines that fit in the heap beside a screen of the given height;
+// each line takes its cells plus a byte in each of the emulator's line tables
+static unsigned int scrollback_lines(unsigned int height) {
+    extern char __StackLimit;
+    ptrdiff_t heap = &__StackLimit - (char *)sbrk(0) - HEAP_RESERVE;
+    size_t line_size = FB_WIDTH_CHAR * sizeof(lw_cell_t) + 4;
+    if (heap <= 0)
+        return 0;
+    size_t lines = heap / line_size;
+    if (lines <= LW_SCREEN_LINES(height))
+        return 0;
+    return lines - LW_SCREEN_LINES(height);
+}
+
 static int old_keyboard_leds;
 int main(void) {
 #if !STANDALONE
-    set_sys_clock_khz(vga_660x477_60_sys_clock_khz, false);
+    set_sys_clock_khz(video_modes[video_mode].sys_clock_khz, false);
     stdio_init_all();
 #endif
     for (int i = 0; i < N_UARTS; i++) {
@@ -615,10 +1141,20 @@ int main(void) {
         gpio_pull_up(uart_data[i].tx);
     }
 
+    // room for the tallest mode, less the status line
     vt100 = lw_terminal_vt100_init(NULL, NULL, master_write, char_attr,
-                                   FB_WIDTH_CHAR, FB_HEIGHT_CHAR - 1);
+                                   FB_WIDTH_CHAR, FB_HEIGHT_CHAR - 1,
+                                   scrollback_lines(FB_HEIGHT_CHAR - 1));
     vt100->map_unicode = map_unicode;
     vt100->do_bell = visual_bell;
+    vt100->scroll_wait = scroll_wait;
+    vt100->soft_font_base = SOFT_FONT_BASE;
+    vt100->load_glyph = load_glyph;
+    vt100->soft_font_loaded = soft_font_loaded;
+    vt100->ops = vt100_ops;
+    vt100->ops_size = COUNT_OF(vt100_ops);
+    video_rows = video_modes[video_mode].visible_height / CHAR_Y;
+    lw_terminal_vt100_set_height(vt100, video_rows - 1);
     multicore_launch_core1(core1_entry);
 
     scrnprintf(" \r");
@@ -633,25 +1169,62 @@ int main(void) {
     scrnprintf("\033[H\033[J\r\n ** \033[1mCR100 Terminal \033[7m READY \033[m "
                "**\r\n\r\n");
 
+    while (!render_stats.ready) {
+        /* NOTHING */
+    }
+    if (render_stats.boot_scanline > render_stats.scanline_budget) {
+        scrnprintf("\033[7m VIDEO TOO SLOW \033[m %u cycles per scanline, "
+                   "%u available\r\n\r\n",
+                   (unsigned)render_stats.boot_scanline,
+                   (unsigned)render_stats.scanline_budget);
+    }
+    uint32_t old_video_errors = 0;
+    unsigned int old_scrollback = 0;
+
     while (true) {
-        int c = port_getc();
-        if (c > 0) {
-            char cc = c;
-            lw_terminal_vt100_read_buf(vt100, &cc, 1);
+        // everything that has arrived goes to the emulator at once, so that
+        // runs of text queue as few screen changes as possible
+        char buf[64];
+        size_t n = 0;
+        int c;
+        while (n < sizeof(buf) && (c = port_getc()) > 0) {
+            buf[n++] = c;
+        }
+        if (n) {
+            lw_terminal_vt100_read_buf(vt100, buf, n);
         }
         c = kbd_getc_nonblocking();
         if (c != EOF) {
             port_putc(c);
         }
+        // the key may also have been read while the emulator waited for
+        // smooth scrolls, in the middle of a control sequence
+        if (video_switch_pending) {
+            video_switch_pending = false;
+            switch_video_mode();
+        }
         if (keyboard_leds != old_keyboard_leds) {
             status_refresh = true;
             old_keyboard_leds = keyboard_leds;
         }
+        uint32_t video_errors =
+            render_stats.underruns + render_stats.missed_frames;
+        if (video_errors != old_video_errors) {
+            status_refresh = true;
+            old_video_errors = video_errors;
+        }
+        if (snapshot.scrollback != old_scrollback) {
+            status_refresh = true;
+            old_scrollback = snapshot.scrollback;
+        }
 
         if (status_refresh) {
-            status_printf("\3%s\3 \2 %s %s", port_describe(),
+            status_printf("\3%s\3 \2 %-10s %s %s %s%s", port_describe(),
+                          video_modes[video_mode].name,
                           keyboard_leds & LED_CAPS ? "\22 CAPS \2" : "      ",
-                          keyboard_leds & LED_NUM ? "\22 NUM \2" : "     ");
+                          keyboard_leds & LED_NUM ? "\22 NUM \2" : "     ",
+                          video_errors ? "\22 UNDERRUN \2" : "",
+                          old_scrollback ? " \22 SCROLLBACK \2" : "");
             status_refresh = false;
         }
     }
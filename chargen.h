@@ -1,3 +1,22 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
+// Counters kept by the renderer on core1, for core0 to read. Times are in
+// system clock cycles.
+typedef struct {
+    // frames rendered, frames in which the pixel state machine ran out of
+    // data (FDEBUG TXSTALL), and frames that weren't done by the next vblank
+    uint32_t frames, underruns, missed_frames;
+    // the most time core1 has spent producing one scanline, against the time
+    // the pixel state machine takes to send one
+    uint32_t worst_scanline, scanline_budget;
+    // a worst-case scanline, timed at boot; 0 when rendering to the FIFO
+    uint32_t boot_scanline;
+    // boot_scanline and scanline_budget are valid
+    bool ready;
+} render_stats_t;
+extern volatile render_stats_t render_stats;
+
 int scrnprintf(const char *fmt, ...);
@@ -139,7 +139,7 @@ void vt100_headless_fork(struct vt100_headless *this, const char *progname,
     } else {
         this->term = lw_terminal_vt100_init(
             this, lw_terminal_parser_default_unimplemented, master_write, NULL,
-            winsize.ws_col, winsize.ws_row);
+            winsize.ws_col, winsize.ws_row, 0);
         ioctl(this->master, TIOCSWINSZ, &winsize);
     }
     restore_termios(this, 0);
@@ -68,6 +68,7 @@ static void lw_terminal_parser_call_CSI(struct lw_terminal *this, char c) {
 leave:
     this->state = INIT;
     this->flag = '\0';
+    this->intermediate = '\0';
     this->stack_ptr = 0;
     this->argc = 0;
 }
@@ -99,24 +100,51 @@ leave:
 }
 
 static void lw_terminal_parser_call_GSET(struct lw_terminal *this, char c) {
-    if (c < '0' || c > 'B' ||
+    if (c < '0' || c > '~' ||
         ((term_action *)&this->callbacks.scs)[c - '0'] == NULL) {
         if (this->unimplemented != NULL)
             this->unimplemented(this, "GSET", c);
         goto leave;
     }
+    this->final = c;
     ((term_action *)&this->callbacks.scs)[c - '0'](this);
 leave:
     this->state = INIT;
+    this->intermediate = '\0';
+    this->final = '\0';
     this->stack_ptr = 0;
     this->argc = 0;
 }
 
+static void lw_terminal_parser_call_DCS(struct lw_terminal *this, char c) {
+    lw_terminal_parser_parse_params(this);
+    this->dcs_put = NULL;
+    if (((term_action *)&this->callbacks.dcs)[c - '0'] == NULL) {
+        if (this->unimplemented != NULL)
+            this->unimplemented(this, "DCS", c);
+        goto leave;
+    }
+    ((term_action *)&this->callbacks.dcs)[c - '0'](this);
+leave:
+    this->state = DCS_DATA;
+    this->flag = '\0';
+    this->intermediate = '\0';
+    this->stack_ptr = 0;
+    this->argc = 0;
+}
+
+static void lw_terminal_parser_end_DCS(struct lw_terminal *this) {
+    if (this->dcs_put != NULL)
+        this->dcs_put(this, LW_DCS_END);
+    this->dcs_put = NULL;
+}
+
 /*
 ** INIT
 **  \_ ESC "\033"
 **  |   \_ CSI   "\033["
 **  |   |   \_ c == '?' : term->flag = '?'
+**  |   |   \_ c >= ' ' && c <= '/' : term->intermediate = c
 **  |   |   \_ c == ';' || (c >= '0' && c <= '9') : term_push
 **  |   |   \_ else : term_call_CSI()
 **  |   \_ HASH  "\033#"
@@ -124,7 +152,14 @@ leave:
 **  |   \_ G0SET "\033("
 **  |   |   \_ term_call_GSET()
 **  |   \_ G1SET "\033)"
-**  |   |   \_ term_call_GSET()
+**  |   |   \_ c >= ' ' && c <= '/' : term->intermediate = c
+**  |   |   \_ else : term_call_GSET()
+**  |   \_ DCS "\033P"
+**  |   |   \_ as CSI, then term_call_DCS()
+**  |   |       \_ DCS_DATA
+**  |   |           \_ c == ESC, CAN or SUB : term->dcs_put(LW_DCS_END)
+**  |   |           \_ else : term->dcs_put(c)
+**  |   \_ c == '\\' : ST, ignored
 **  \_ term->write()
 */
 void lw_terminal_parser_read(struct lw_terminal *this, char c) {
@@ -142,6 +177,10 @@ void lw_terminal_parser_read(struct lw_terminal *this, char c) {
             this->state = G0SET;
         else if (c == ')')
             this->state = G1SET;
+        else if (c == 'P')
+            this->state = DCS;
+        else if (c == '\\')
+            this->state = INIT;
         else if (c >= '0' && c <= 'z')
             lw_terminal_parser_call_ESC(this, c);
         else
@@ -152,7 +191,33 @@ void lw_terminal_parser_read(struct lw_terminal *this, char c) {
         else
             this->write(this, c);
     } else if (this->state == G0SET || this->state == G1SET) {
-        lw_terminal_parser_call_GSET(this, c);
+        if (c >= ' ' && c <= '/')
+            this->intermediate = c;
+        else
+            lw_terminal_parser_call_GSET(this, c);
+    } else if (this->state == DCS) {
+        if (c == '?')
+            this->flag = '?';
+        else if (c == ';' || (c >= '0' && c <= '9'))
+            lw_terminal_parser_push(this, c);
+        else if (c >= ' ' && c <= '/')
+            this->intermediate = c;
+        else if (c >= '@' && c <= '~')
+            lw_terminal_parser_call_DCS(this, c);
+        else if (c == '\033')
+            this->state = ESC;
+        else
+            this->state = INIT;
+    } else if (this->state == DCS_DATA) {
+        if (c == '\033') {
+            lw_terminal_parser_end_DCS(this);
+            this->state = ESC;
+        } else if (c == '\030' || c == '\032') {
+            lw_terminal_parser_end_DCS(this);
+            this->state = INIT;
+        } else if (this->dcs_put != NULL) {
+            this->dcs_put(this, (unsigned char)c);
+        }
     } else if (this->state == CSI) {
         if (c == '?')
             this->flag = '?';
@@ -160,6 +225,8 @@ void lw_terminal_parser_read(struct lw_terminal *this, char c) {
             this->flag = '>';
         else if (c == ';' || (c >= '0' && c <= '9'))
             lw_terminal_parser_push(this, c);
+        else if (c >= ' ' && c <= '/')
+            this->intermediate = c;
         else if (c >= '?' && c <= 'z')
             lw_terminal_parser_call_CSI(this, c);
         else
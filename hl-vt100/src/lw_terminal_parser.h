@@ -42,11 +42,17 @@
 ** \033...  maps to terminal->callbacks->esc
 ** \033[... maps to terminal->callbacks->csi
 ** \033#... maps to terminal->callbacks->hash
+** \033P... maps to terminal->callbacks->dcs
 ** and \033( and \033) maps to terminal->callbacks->scs
 **
-** In 'callbacks', esc, csi, hash and scs are structs ascii_callbacks
+** In 'callbacks', esc, csi, hash, scs and dcs are structs ascii_callbacks
 ** where you can bind your callbacks.
 **
+** A dcs callback is called on the final byte of the device control
+** string's introducer, and may set terminal->dcs_put to receive the
+** string's data bytes, then LW_DCS_END when the string is terminated
+** (by ST, CAN or SUB). The data of a string no callback takes is dropped.
+**
 ** Typically when terminal parses \033[42;43m
 ** it calls terminal->callbacks->csi->m(terminal);
 **
@@ -85,6 +91,10 @@
 **     \033[?1049h -> The flag will be '?'
 **     Otherwise the flag is set to '\0'
 **
+** char final;
+**     The final byte of an scs sequence, for callbacks bound to several,
+**     with its intermediate byte (if any) in intermediate
+**
 ** void (*unimplemented)(struct terminal*, char *seq, char chr) :
 **     Can be NULL, you can hook here to know where the terminal parses an
 **     escape sequence on which you have not registered a callback.
@@ -98,7 +108,10 @@
 
 #define TERM_STACK_SIZE 1024
 
-enum term_state { INIT, ESC, HASH, G0SET, G1SET, CSI };
+enum term_state { INIT, ESC, HASH, G0SET, G1SET, CSI, DCS, DCS_DATA };
+
+/* Passed to dcs_put at the end of a device control string */
+#define LW_DCS_END (-1)
 
 struct lw_terminal;
 
@@ -184,6 +197,11 @@ struct ascii_callbacks {
     term_action x;
     term_action y;
     term_action z;
+
+    term_action h7B;
+    term_action h7C;
+    term_action h7D;
+    term_action h7E;
 };
 
 struct term_callbacks {
@@ -191,6 +209,7 @@ struct term_callbacks {
     struct ascii_callbacks csi;
     struct ascii_callbacks hash;
     struct ascii_callbacks scs;
+    struct ascii_callbacks dcs;
 };
 
 struct lw_terminal {
@@ -204,6 +223,10 @@ struct lw_terminal {
     unsigned int stack_ptr;
     struct term_callbacks callbacks;
     char flag;
+    char intermediate; /* Last intermediate byte (0x20-0x2f) of CSI/SCS/DCS */
+    char final; /* Final byte of an SCS, for callbacks bound to several */
+    /* Receives the data of the device control string being read */
+    void (*dcs_put)(struct lw_terminal *, int c);
     void *user_data;
     void (*unimplemented)(struct lw_terminal *, char *seq, char chr);
 };
@@ -29,6 +29,12 @@
 #include <string.h>
 #include <unistd.h>
 
+#if defined(PICO_BUILD)
+#include "pico.h"
+#else
+#define __not_in_flash_func(x) x
+#endif
+
 static unsigned int get_mode_mask(unsigned int mode) {
     switch (mode) {
     case LNM:
@@ -51,6 +57,10 @@ static unsigned int get_mode_mask(unsigned int mode) {
         return MASK_DECARM;
     case DECINLM:
         return MASK_DECINLM;
+    case DECTCEM:
+        return MASK_DECTCEM;
+    case IRM:
+        return MASK_IRM;
     default:
         return 0;
     }
@@ -68,6 +78,7 @@ static unsigned int get_mode_mask(unsigned int mode) {
 
   Parameter    Mode Mnemonic    Mode Function
   0                             Error (ignored)
+  4            IRM              Insertion-replacement
   20           LNM              Line feed new line mode
 
 
@@ -88,6 +99,11 @@ static unsigned int get_mode_mask(unsigned int mode) {
   7            DECAWM           Auto wrap
   8            DECARM           Auto repeating
   9            DECINLM          Interlace
+  25           DECTCEM          Text cursor enable
+  47                            Alternate screen (xterm)
+  1047                          Alternate screen, cleared on leaving it
+  1049                          Alternate screen, cleared on entering it,
+                                with the cursor saved and restored
 
   LNM – Line Feed/New Line Mode
   -----------------------------
@@ -103,6 +119,14 @@ static unsigned int get_mode_mask(unsigned int mode) {
   This mode does not affect the index (IND), or next line (NEL) format
   effectors.
 
+  IRM – Insertion-Replacement Mode
+  --------------------------------
+  This is a parameter applicable to set mode (SM) and reset mode (RM)
+  control sequences. In the set state, each character received moves the
+  character at the active position and those to its right one position
+  right before it is displayed; the last character of the line is lost.
+  In the reset state, characters replace what is at the active position.
+
   DECCKM – Cursor Keys Mode (DEC Private)
   ---------------------------------------
   This is a private parameter applicable to set mode (SM) and reset mode
@@ -188,29 +212,302 @@ static unsigned int get_mode_mask(unsigned int mode) {
 
 #define MOD1(a, b) ((a < b) ? a : a - b)
 
-#define SCREEN_PTR(vt100, x, y)                                                \
-    MOD1((vt100->top_line * vt100->width + x + vt100->width * y),              \
-         (vt100->width * SCROLLBACK * vt100->height))
 
-#define FROZEN_SCREEN_PTR(vt100, x, y)                                         \
-    (MOD1(x + vt100->width * y, (vt100->width * SCROLLBACK * vt100->height)))
+/*
+** The renderer's half of the op queue: make a change to the screen. Runs on
+** the renderer's core (so not from flash, and without a switch, whose jump
+** table would be).
+*/
+static void __not_in_flash_func(apply_op)(struct lw_terminal_vt100 *vt100,
+                                          const struct lw_op *op) {
+    unsigned int i;
 
-static lw_cell_t aget(struct lw_terminal_vt100 *headless_term, unsigned int x,
-                      unsigned int y) {
-    if (y < headless_term->margin_top || y > headless_term->margin_bottom)
-        return headless_term
-            ->afrozen_screen[FROZEN_SCREEN_PTR(headless_term, x, y)];
-    else
-        return headless_term->ascreen[SCREEN_PTR(headless_term, x, y)];
+    if (op->kind == LW_OP_FILL) {
+        lw_cell_t *dst = op->dst;
+        for (i = 0; i < op->count; ++i)
+            dst[i] = op->arg.cells[0];
+    } else if (op->kind == LW_OP_PUT) {
+        lw_cell_t *dst = op->dst;
+        for (i = 0; i < op->count; ++i)
+            dst[i] = op->arg.cells[i];
+    } else if (op->kind == LW_OP_COPY) {
+        lw_cell_t *dst = op->dst;
+        const lw_cell_t *src = op->arg.src;
+        if (dst < src) {
+            for (i = 0; i < op->count; ++i)
+                dst[i] = src[i];
+        } else {
+            for (i = op->count; i--;)
+                dst[i] = src[i];
+        }
+    } else if (op->kind == LW_OP_BYTES) {
+        uint8_t *dst = op->dst;
+        for (i = 0; i < op->count; ++i)
+            dst[i] = op->arg.value;
+    } else if (op->kind == LW_OP_WORD) {
+        *(volatile uint32_t *)op->dst = op->arg.value;
+    } else if (op->kind == LW_OP_SCROLL) {
+        uint8_t *rows = op->dst;
+        unsigned int last = op->count - 1;
+        if (op->arg.value & LW_OP_SCROLL_DOWN) {
+            for (i = last; i > 0; --i)
+                rows[i] = rows[i - 1];
+            rows[0] = op->arg.value;
+        } else {
+            vt100->shown_scrolled[vt100->shown_scrolls++ &
+                                  (SMOOTH_SCROLL_QUEUE - 1)] = rows[0];
+            if (op->arg.value & LW_OP_SCROLL_SAVE) {
+                i = op->arg.value >> 16;
+                vt100->shown_history[i] = rows[0];
+                vt100->shown_history_next =
+                    i + 1 < vt100->shown.history ? i + 1 : 0;
+                if (vt100->shown_saved < vt100->shown.history)
+                    vt100->shown_saved++;
+            }
+            for (i = 0; i < last; ++i)
+                rows[i] = rows[i + 1];
+            rows[last] = op->arg.value;
+        }
+    }
+    if (op->row == LW_OP_ALL_ROWS) {
+        for (i = 0; i < vt100->shown.height; ++i)
+            vt100->dirty[i] = 1;
+    } else if (op->row != LW_OP_NO_ROW) {
+        vt100->dirty[op->row] = 1;
+    }
+}
+
+/*
+** Apply the ops the emulator has handed over, see lw_terminal_vt100::ops.
+** Call it from the renderer's core between frames, before
+** lw_terminal_vt100_snapshot. Whole commits are applied, up to LW_APPLY_CELLS
+** cells' worth; the rest are left for the next call.
+*/
+void __not_in_flash_func(lw_terminal_vt100_apply)(
+    struct lw_terminal_vt100 *vt100) {
+    unsigned int tail = vt100->ops_tail;
+    unsigned int head = vt100->ops_head;
+    unsigned int cells = 0, commit_ops = 0;
+
+    __sync_synchronize();
+    while (tail != head) {
+        const struct lw_op *op = &vt100->ops[tail];
+        if (commit_ops) {
+            commit_ops--;
+        } else {
+            unsigned int cost =
+                op->kind == LW_OP_COMMIT ? op->arg.value : op->count + 1u;
+            if (cells && cells + cost > LW_APPLY_CELLS)
+                break;
+            cells += cost;
+            if (op->kind == LW_OP_COMMIT)
+                commit_ops = op->count;
+        }
+        apply_op(vt100, op);
+        if (++tail == vt100->ops_size)
+            tail = 0;
+    }
+    __sync_synchronize();
+    vt100->ops_tail = tail;
+}
+
+/* Hand the ops queued so far over to the renderer */
+static void publish_ops(struct lw_terminal_vt100 *vt100) {
+    if (vt100->ops == NULL)
+        return;
+    __sync_synchronize();
+    vt100->ops_head = vt100->ops_end;
+    vt100->ops_run = -1;
+}
+
+/* Wait until there is room in the queue for n more ops */
+static void wait_ops(struct lw_terminal_vt100 *vt100, unsigned int n) {
+    if (vt100->ops == NULL)
+        return;
+    while (true) {
+        unsigned int room =
+            vt100->ops_tail + vt100->ops_size - vt100->ops_end - 1;
+        if (MOD1(room, vt100->ops_size) >= n)
+            break;
+        publish_ops(vt100);
+        if (vt100->scroll_wait != NULL)
+            vt100->scroll_wait(vt100->user_data);
+    }
+}
+
+static void queue_op(struct lw_terminal_vt100 *vt100, const struct lw_op *op) {
+    if (vt100->ops == NULL) {
+        apply_op(vt100, op);
+        return;
+    }
+    wait_ops(vt100, 1);
+    vt100->ops[vt100->ops_end] = *op;
+    vt100->ops_run = op->kind == LW_OP_FILL ? (int)vt100->ops_end : -1;
+    if (++vt100->ops_end == vt100->ops_size)
+        vt100->ops_end = 0;
+}
+
+static void fill(struct lw_terminal_vt100 *vt100, lw_cell_t *dst, lw_cell_t c,
+                 size_t n, uint8_t row) {
+    while (n) {
+        struct lw_op op = {LW_OP_FILL, row, n < 0xffff ? n : 0xffff, dst,
+                           {{c}}};
+        queue_op(vt100, &op);
+        dst += op.count;
+        n -= op.count;
+    }
+}
+
+static void copy(struct lw_terminal_vt100 *vt100, lw_cell_t *dst,
+                 const lw_cell_t *src, size_t n, uint8_t row) {
+    struct lw_op op = {LW_OP_COPY, row, n, dst, {.src = src}};
+    queue_op(vt100, &op);
+}
+
+static void store_bytes(struct lw_terminal_vt100 *vt100, uint8_t *dst,
+                        uint8_t value, size_t n, uint8_t row) {
+    struct lw_op op = {LW_OP_BYTES, row, n, dst, {.value = value}};
+    queue_op(vt100, &op);
+}
+
+static void store_word(struct lw_terminal_vt100 *vt100, volatile void *dst,
+                       uint32_t value) {
+    struct lw_op op = {LW_OP_WORD, LW_OP_NO_ROW, 1, (void *)dst,
+                       {.value = value}};
+    queue_op(vt100, &op);
+}
+
+static void mark_all_dirty(struct lw_terminal_vt100 *vt100) {
+    struct lw_op op = {LW_OP_DIRTY, LW_OP_ALL_ROWS, 0, NULL, {{0}}};
+    queue_op(vt100, &op);
+}
+
+/* Show the emulator's margins and size */
+static void show_view(struct lw_terminal_vt100 *vt100) {
+    store_word(vt100, &vt100->shown.width, vt100->width);
+    store_word(vt100, &vt100->shown.height, vt100->height);
+    store_word(vt100, &vt100->shown.margin_top, vt100->margin_top);
+    store_word(vt100, &vt100->shown.margin_bottom, vt100->margin_bottom);
+    store_word(vt100, &vt100->shown.scroll_count, vt100->scroll_count);
+    store_word(vt100, &vt100->shown.history, vt100->free_count);
+    mark_all_dirty(vt100);
+}
+
+/*
+** Changes to the mapping from display rows to lines (scrolls, margins) are
+** bracketed by begin_commit/end_commit. The ops in between are handed to the
+** renderer together behind an LW_OP_COMMIT, and so are applied between the
+** same two frames.
+*/
+static void begin_commit(struct lw_terminal_vt100 *vt100) {
+    struct lw_op op = {LW_OP_COMMIT, LW_OP_NO_ROW, 0, NULL, {.value = 0}};
+
+    wait_ops(vt100, LW_OPS_PER_COMMIT);
+    if (vt100->ops == NULL)
+        return;
+    vt100->commit_op = vt100->ops_end;
+    queue_op(vt100, &op);
+}
+
+static void end_commit(struct lw_terminal_vt100 *vt100) {
+    if (vt100->ops != NULL) {
+        /* Not yet handed over, so the renderer doesn't see it change */
+        struct lw_op *commit = &vt100->ops[vt100->commit_op];
+        unsigned int i;
+        for (i = vt100->commit_op + 1;; ++i) {
+            if (i == vt100->ops_size)
+                i = 0;
+            if (i == vt100->ops_end)
+                break;
+            commit->count++;
+            commit->arg.value += vt100->ops[i].count + 1u;
+        }
+    }
+    publish_ops(vt100);
+}
+
+/*
+** Wait until no more than n smooth scrolls are left for the renderer to
+** animate. Anything else that moves lines around waits for all of them.
+*/
+static void wait_scrolls(struct lw_terminal_vt100 *vt100, unsigned int n) {
+    if (vt100->scroll_wait == NULL)
+        return;
+    publish_ops(vt100);
+    while (vt100->scroll_count - vt100->scroll_done > n)
+        vt100->scroll_wait(vt100->user_data);
+}
+
+/* Point row y at line, for the emulator */
+static void map_row(struct lw_terminal_vt100 *vt100, unsigned int y,
+                    unsigned int line) {
+    vt100->rows[y] = line;
+    vt100->row_cells[y] = vt100->ascreen + vt100->width * line;
+}
+
+static uint8_t *line_size(struct lw_terminal_vt100 *vt100, unsigned int y) {
+    return &vt100->aline_size[vt100->rows[y]];
 }
 
+/* Change the lw_line_size of line y, for the emulator and the renderer */
+static void resize_line(struct lw_terminal_vt100 *vt100, unsigned int y,
+                        uint8_t size) {
+    vt100->aline_size[vt100->rows[y]] = size;
+    store_bytes(vt100, &vt100->shown_line_size[vt100->rows[y]], size, 1, y);
+}
+
+/* The cells of line y that are shown, fewer on double-width lines */
+static unsigned int line_width(struct lw_terminal_vt100 *vt100,
+                               unsigned int y) {
+    if (*line_size(vt100, y) == LW_LINE_SINGLE)
+        return vt100->width;
+    return vt100->width / 2;
+}
+
+/*
+** Move the cursor back onto the cells of a double-width line it was moved to
+** from a wider one. On a single-width line x == width is a pending wrap and
+** is left alone.
+*/
+static void clamp_x(struct lw_terminal_vt100 *vt100) {
+    if (*line_size(vt100, vt100->y) != LW_LINE_SINGLE &&
+        vt100->x >= line_width(vt100, vt100->y))
+        vt100->x = line_width(vt100, vt100->y) - 1;
+}
+
+static lw_cell_t *cell_ptr(struct lw_terminal_vt100 *vt100, unsigned int x,
+                           unsigned int y) {
+    return vt100->row_cells[y] + x;
+}
+
+/*
+** Cells written one after the other along a line (text, erasing) extend the
+** last op queued rather than each taking one
+*/
 static void aset(struct lw_terminal_vt100 *headless_term, unsigned int x,
                  unsigned int y, lw_cell_t c) {
-    if (y < headless_term->margin_top || y > headless_term->margin_bottom)
-        headless_term->afrozen_screen[FROZEN_SCREEN_PTR(headless_term, x, y)] =
-            c;
-    else
-        headless_term->ascreen[SCREEN_PTR(headless_term, x, y)] = c;
+    lw_cell_t *dst = cell_ptr(headless_term, x, y);
+
+    if (headless_term->ops_run >= 0) {
+        struct lw_op *run = &headless_term->ops[headless_term->ops_run];
+        if (run->row == y && (lw_cell_t *)run->dst + run->count == dst) {
+            if (run->kind == LW_OP_FILL && run->arg.cells[0] == c &&
+                run->count < 0xffff) {
+                run->count++;
+                return;
+            }
+            if (run->kind == LW_OP_FILL && run->count < LW_OP_PUT_MAX) {
+                for (unsigned int i = 1; i < run->count; ++i)
+                    run->arg.cells[i] = run->arg.cells[0];
+                run->kind = LW_OP_PUT;
+            }
+            if (run->kind == LW_OP_PUT && run->count < LW_OP_PUT_MAX) {
+                run->arg.cells[run->count++] = c;
+                return;
+            }
+        }
+    }
+    fill(headless_term, dst, c, 1, y);
 }
 
 static void set(struct lw_terminal_vt100 *headless_term, unsigned int x,
@@ -218,33 +515,167 @@ static void set(struct lw_terminal_vt100 *headless_term, unsigned int x,
     aset(headless_term, x, y, (unsigned char)c | headless_term->attr);
 }
 
-lw_cell_t lw_terminal_vt100_aget(struct lw_terminal_vt100 *vt100,
-                                 unsigned int x, unsigned int y) {
-    if (y < vt100->margin_top || y > vt100->margin_bottom)
-        return vt100->afrozen_screen[FROZEN_SCREEN_PTR(vt100, x, y)];
-    else
-        return vt100->ascreen[SCREEN_PTR(vt100, x, y)];
+/*
+** Row-wise bulk changes, each a single op however many cells it covers: set
+** n cells of row y from column x to c, move n cells of row y from column
+** from to column to (which may overlap), and erase row y, returning it to
+** single width.
+*/
+static void fill_row(struct lw_terminal_vt100 *vt100, unsigned int x,
+                     unsigned int y, lw_cell_t c, unsigned int n) {
+    fill(vt100, cell_ptr(vt100, x, y), c, n, y);
 }
 
-static void froze_line(struct lw_terminal_vt100 *vt100, unsigned int y) {
-    memcpy(vt100->afrozen_screen + vt100->width * y,
-           vt100->ascreen + SCREEN_PTR(vt100, 0, y),
-           vt100->width * sizeof(lw_cell_t));
+static void move_row(struct lw_terminal_vt100 *vt100, unsigned int to,
+                     unsigned int from, unsigned int y, unsigned int n) {
+    if (n && to != from)
+        copy(vt100, cell_ptr(vt100, to, y), cell_ptr(vt100, from, y), n, y);
 }
 
-static void unfroze_line(struct lw_terminal_vt100 *vt100, unsigned int y) {
-    memcpy(vt100->ascreen + SCREEN_PTR(vt100, 0, y),
-           vt100->afrozen_screen + vt100->width * y,
-           vt100->width * sizeof(lw_cell_t));
+static void erase_row(struct lw_terminal_vt100 *vt100, unsigned int y) {
+    resize_line(vt100, y, LW_LINE_SINGLE);
+    fill_row(vt100, 0, y, ' ' | vt100->attr, vt100->width);
 }
 
-static void blank_screen(struct lw_terminal_vt100 *lw_terminal_vt100) {
-    unsigned int x;
+/*
+** Move display rows first to last one line up (or down), bringing in a blank
+** line at last (or first). With save, the line that leaves goes to the
+** scrollback, and the oldest line there comes in; otherwise it is exchanged
+** for the oldest spare line.
+*/
+static void rotate_rows(struct lw_terminal_vt100 *vt100, unsigned int first,
+                        unsigned int last, bool up, bool save) {
+    unsigned int n = last - first;
+    unsigned int out = up ? vt100->rows[first] : vt100->rows[last];
+    unsigned int line;
+    struct lw_op op = {LW_OP_SCROLL, LW_OP_ALL_ROWS, n + 1,
+                       &vt100->shown_rows[first], {.value = 0}};
+
+    if (save && vt100->free_count) {
+        line = vt100->free_lines[vt100->free_next];
+        vt100->free_lines[vt100->free_next] = out;
+        op.arg.value = LW_OP_SCROLL_SAVE | vt100->free_next << 16;
+        if (++vt100->free_next == vt100->free_count)
+            vt100->free_next = 0;
+    } else {
+        unsigned int spare = vt100->spare_next++ & (SMOOTH_SCROLL_QUEUE - 1);
+        line = vt100->spare_lines[spare];
+        vt100->spare_lines[spare] = out;
+    }
+    op.arg.value |= line;
+    if (up) {
+        memmove(&vt100->rows[first], &vt100->rows[first + 1], n);
+        memmove(&vt100->row_cells[first], &vt100->row_cells[first + 1],
+                n * sizeof(vt100->row_cells[0]));
+        map_row(vt100, last, line);
+    } else {
+        memmove(&vt100->rows[first + 1], &vt100->rows[first], n);
+        memmove(&vt100->row_cells[first + 1], &vt100->row_cells[first],
+                n * sizeof(vt100->row_cells[0]));
+        map_row(vt100, first, line);
+        op.arg.value |= LW_OP_SCROLL_DOWN;
+    }
+    queue_op(vt100, &op);
+    erase_row(vt100, up ? last : first);
+}
+
+/*
+** Show lines 0 to height-1 in order on the main screen, for the emulator and
+** the renderer. The alternate screen gets the next height lines, then come
+** the spare lines of both, and the rest are an empty scrollback.
+*/
+static void home_rows(struct lw_terminal_vt100 *vt100) {
+    unsigned int height = vt100->height;
     unsigned int y;
 
-    for (x = 0; x < lw_terminal_vt100->width; ++x)
-        for (y = 0; y < lw_terminal_vt100->height; ++y)
-            set(lw_terminal_vt100, x, y, ' ');
+    for (y = 0; y < height; ++y) {
+        map_row(vt100, y, y);
+        store_bytes(vt100, &vt100->shown_rows[y], y, 1, LW_OP_NO_ROW);
+        vt100->other_rows[y] = height + y;
+    }
+    vt100->alternate = false;
+    for (y = 0; y < SMOOTH_SCROLL_QUEUE; ++y) {
+        vt100->spare_lines[y] = 2 * height + y;
+        vt100->other_spare_lines[y] = 2 * height + SMOOTH_SCROLL_QUEUE + y;
+    }
+    vt100->spare_next = vt100->other_spare_next = 0;
+    vt100->free_count = vt100->pool_lines - LW_SCREEN_LINES(height);
+    vt100->free_next = 0;
+    for (y = 0; y < vt100->free_count; ++y)
+        vt100->free_lines[y] = LW_SCREEN_LINES(height) + y;
+    store_word(vt100, &vt100->shown_saved, 0);
+    store_word(vt100, &vt100->shown_history_next, 0);
+}
+
+/* Exchange the rows and spare lines of the main and alternate screens */
+static void swap_screens(struct lw_terminal_vt100 *vt100) {
+    unsigned int tmp;
+    unsigned int y;
+
+    for (y = 0; y < vt100->height; ++y) {
+        uint8_t line = vt100->other_rows[y];
+        vt100->other_rows[y] = vt100->rows[y];
+        map_row(vt100, y, line);
+        store_bytes(vt100, &vt100->shown_rows[y], line, 1, y);
+    }
+    for (y = 0; y < SMOOTH_SCROLL_QUEUE; ++y) {
+        tmp = vt100->spare_lines[y];
+        vt100->spare_lines[y] = vt100->other_spare_lines[y];
+        vt100->other_spare_lines[y] = tmp;
+    }
+    tmp = vt100->spare_next;
+    vt100->spare_next = vt100->other_spare_next;
+    vt100->other_spare_next = tmp;
+    vt100->alternate = !vt100->alternate;
+}
+
+/*
+** The screen as the emulator has it, without ops; with them, only once the
+** renderer has applied the changes
+*/
+lw_cell_t lw_terminal_vt100_aget(struct lw_terminal_vt100 *vt100,
+                                 unsigned int x, unsigned int y) {
+    return *cell_ptr(vt100, x, y);
+}
+
+/*
+** Resize the screen, clearing it, resetting the margins and homing the cursor
+** as a VT100 does on DECCOLM. Lines are stored `width` cells apart, so all of
+** the (132-column) line storage is blanked first, and the renderer never sees
+** lines of one length read as the other.
+*/
+static void reset_screen(struct lw_terminal_vt100 *vt100, unsigned int width,
+                         unsigned int height) {
+    lw_cell_t blank = ' ' | vt100->attr;
+    size_t cells = 132 * vt100->pool_lines;
+    size_t i;
+
+    wait_scrolls(vt100, 0);
+    /* In commits the renderer can apply a frame at a time, see LW_OP_COMMIT */
+    for (i = 0; i < cells; i += LW_APPLY_CELLS - 1) {
+        begin_commit(vt100);
+        fill(vt100, vt100->ascreen + i, blank,
+             cells - i < LW_APPLY_CELLS - 1 ? cells - i : LW_APPLY_CELLS - 1,
+             LW_OP_NO_ROW);
+        end_commit(vt100);
+    }
+    begin_commit(vt100);
+    memset(vt100->aline_size, LW_LINE_SINGLE, vt100->pool_lines);
+    store_bytes(vt100, vt100->shown_line_size, LW_LINE_SINGLE,
+                vt100->pool_lines, LW_OP_NO_ROW);
+    vt100->width = width;
+    vt100->height = height;
+    vt100->margin_top = 0;
+    vt100->margin_bottom = vt100->height - 1;
+    vt100->x = vt100->y = 0;
+    home_rows(vt100);
+    show_view(vt100);
+    end_commit(vt100);
+}
+
+/* DECCOLM: change the line length */
+static void set_columns(struct lw_terminal_vt100 *vt100, unsigned int width) {
+    reset_screen(vt100, width, vt100->height);
 }
 
 /*
@@ -264,6 +695,45 @@ static void DECSC(struct lw_terminal *term_emul) {
     vt100->saved_y = vt100->y;
 }
 
+/* The mode SM or RM names, an ANSI one unless it has the ? flag */
+static unsigned int mode_arg(struct lw_terminal *term_emul) {
+    if (term_emul->flag == '?')
+        return term_emul->argv[0];
+    return ANSI_MODE(term_emul->argv[0]);
+}
+
+/*
+** SM and RM of the ALT_SCREEN modes: switch to the alternate screen, or back
+** to the main one. Only the row maps are exchanged, so the screen switched to
+** comes back as it was left, without the host redrawing it.
+*/
+static void alt_screen(struct lw_terminal *term_emul, unsigned int mode,
+                       bool set) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int y;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    if (mode == ALT_SCREEN_SAVE_CURSOR && set)
+        DECSC(term_emul);
+    if (vt100->alternate != set) {
+        wait_scrolls(vt100, 0);
+        begin_commit(vt100);
+        if (mode == ALT_SCREEN_CLEAR && !set)
+            for (y = 0; y < vt100->height; ++y)
+                erase_row(vt100, y);
+        swap_screens(vt100);
+        if (mode == ALT_SCREEN_SAVE_CURSOR && set)
+            for (y = 0; y < vt100->height; ++y)
+                erase_row(vt100, y);
+        end_commit(vt100);
+    }
+    if (mode == ALT_SCREEN_SAVE_CURSOR && !set) {
+        vt100->x = vt100->saved_x;
+        vt100->y = vt100->saved_y;
+        clamp_x(vt100);
+    }
+}
+
 /*
   RM – Reset Mode
 
@@ -281,12 +751,12 @@ static void RM(struct lw_terminal *term_emul) {
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     if (term_emul->argc > 0) {
-        mode = term_emul->argv[0];
-        if (mode == DECCOLM) {
-            vt100->width = 80;
-            vt100->x = vt100->y = 0;
-            blank_screen(vt100);
-        }
+        mode = mode_arg(term_emul);
+        if (mode == DECCOLM)
+            set_columns(vt100, 80);
+        if (mode == ALT_SCREEN || mode == ALT_SCREEN_CLEAR ||
+            mode == ALT_SCREEN_SAVE_CURSOR)
+            alt_screen(term_emul, mode, false);
         UNSET_MODE(vt100, mode);
     }
 }
@@ -305,12 +775,13 @@ static void RM(struct lw_terminal *term_emul) {
 x Pm = 0             Normal (default)
 x Pm = 1 / 21        On / Off Bold (bright fg)
   Pm = 3 / 23        On / Off Italic
-  Pm = 4 / 24        On / Off Underline
+x Pm = 4 / 24        On / Off Underline
 x Pm = 5 / 25        On / Off Slow Blink (bright bg)
 x Pm = 6 / 26        On / Off Rapid Blink (bright bg)
 
 x Pm = 7 / 27        On / Off Inverse
   Pm = 8 / 27        On / Off Invisible
+x Pm = 9 / 29        On / Off Crossed-out
 x Pm = 30 / 40       fg/bg Black
 x Pm = 31 / 41       fg/bg Red
 x Pm = 32 / 42       fg/bg Green
@@ -392,6 +863,14 @@ static void SGR(struct lw_terminal *term_emul) {
             vt100->parsed_attr.bold = false;
             break;
 
+        case 4:
+            vt100->parsed_attr.underline = true;
+            break;
+
+        case 24:
+            vt100->parsed_attr.underline = false;
+            break;
+
         case 5:
         case 6:
             vt100->parsed_attr.blink = true;
@@ -410,6 +889,14 @@ static void SGR(struct lw_terminal *term_emul) {
             vt100->parsed_attr.inverse = false;
             break;
 
+        case 9:
+            vt100->parsed_attr.strike = true;
+            break;
+
+        case 29:
+            vt100->parsed_attr.strike = false;
+            break;
+
         case 39:
             vt100->parsed_attr.fg = 7;
             break;
@@ -481,8 +968,8 @@ static void CUP(struct lw_terminal *term_emul) {
     if (arg0 >= (int)vt100->height) {
         arg0 = vt100->height - 1;
     }
-    if (arg1 >= (int)vt100->width) {
-        arg1 = vt100->width - 1;
+    if (arg1 >= (int)line_width(vt100, arg0)) {
+        arg1 = line_width(vt100, arg0) - 1;
     }
     vt100->y = arg0;
     vt100->x = arg1;
@@ -506,17 +993,17 @@ static void SM(struct lw_terminal *term_emul) {
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     if (term_emul->argc > 0) {
-        mode = term_emul->argv[0];
+        mode = mode_arg(term_emul);
         SET_MODE(vt100, mode);
         if (mode == DECANM) {
             /* TODO: Support vt52 mode */
             return;
         }
-        if (mode == DECCOLM) {
-            vt100->width = 132;
-            vt100->x = vt100->y = 0;
-            blank_screen(vt100);
-        }
+        if (mode == DECCOLM)
+            set_columns(vt100, 132);
+        if (mode == ALT_SCREEN || mode == ALT_SCREEN_CLEAR ||
+            mode == ALT_SCREEN_SAVE_CURSOR)
+            alt_screen(term_emul, mode, true);
         if (mode == DECOM) {
             saved_argc = term_emul->argc;
             term_emul->argc = 0;
@@ -544,7 +1031,6 @@ static void DECSTBM(struct lw_terminal *term_emul) {
     unsigned int margin_top;
     unsigned int margin_bottom;
     struct lw_terminal_vt100 *vt100;
-    unsigned int line;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
 
@@ -559,16 +1045,12 @@ static void DECSTBM(struct lw_terminal *term_emul) {
         margin_top = 0;
         margin_bottom = vt100->height - 1;
     }
-    for (line = vt100->margin_top; line < margin_top; ++line)
-        froze_line(vt100, line);
-    for (line = vt100->margin_bottom; line < margin_bottom; ++line)
-        unfroze_line(vt100, line);
-    for (line = margin_top; line < vt100->margin_top; ++line)
-        unfroze_line(vt100, line);
-    for (line = margin_bottom; line < vt100->margin_bottom; ++line)
-        froze_line(vt100, line);
+    wait_scrolls(vt100, 0);
+    begin_commit(vt100);
     vt100->margin_bottom = margin_bottom;
     vt100->margin_top = margin_top;
+    show_view(vt100);
+    end_commit(vt100);
     term_emul->argc = 0;
     CUP(term_emul);
 }
@@ -603,6 +1085,33 @@ static void DA(struct lw_terminal *term_emul) {
     vt100->master_write(vt100->user_data, "\033[?1;0c", 7);
 }
 
+/*
+  DECSCUSR – Set Cursor Style
+
+  ESC [ Ps SP q
+
+  0, 1: blinking block (default)
+  2: steady block
+  3: blinking underline
+  4: steady underline
+  5: blinking bar
+  6: steady bar
+*/
+static void DECSCUSR(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    if (term_emul->intermediate != ' ') {
+        if (term_emul->unimplemented != NULL)
+            term_emul->unimplemented(term_emul, "CSI", 'q');
+        return;
+    }
+    unsigned int style = term_emul->argc ? term_emul->argv[0] : 0;
+    if (style <= 6) {
+        vt100->cursor_style = style ? style : 1;
+    }
+}
+
 static void DSR(struct lw_terminal *term_emul) {
     struct lw_terminal_vt100 *vt100;
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
@@ -641,6 +1150,7 @@ static void DECRC(struct lw_terminal *term_emul) {
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     vt100->x = vt100->saved_x;
     vt100->y = vt100->saved_y;
+    clamp_x(vt100);
 }
 
 /*
@@ -654,13 +1164,185 @@ static void DECRC(struct lw_terminal *term_emul) {
 */
 static void DECALN(struct lw_terminal *term_emul) {
     struct lw_terminal_vt100 *vt100;
-    unsigned int x;
     unsigned int y;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
-    for (x = 0; x < vt100->width; ++x)
-        for (y = 0; y < vt100->height; ++y)
-            set(vt100, x, y, 'E');
+    for (y = 0; y < vt100->height; ++y) {
+        resize_line(vt100, y, LW_LINE_SINGLE);
+        fill_row(vt100, 0, y, 'E' | vt100->attr, vt100->width);
+    }
+}
+
+/*
+  DECDHL – Double-Height Line (DEC Private)
+
+  Top Half: ESC # 3
+  Bottom Half: ESC # 4
+
+  These sequences cause the line containing the active position to become
+  the top or bottom half of a double-height double-width line. The
+  sequences must be used in pairs on adjacent lines and the same character
+  output must be sent to both lines to form full double-height characters.
+  If the line was single width and single height, all characters to the
+  right of the center of the screen are lost. The cursor remains over the
+  same character position unless it would be to the right of the right
+  margin, in which case it is moved to the right margin.
+
+  DECSWL – Single-width Line (DEC Private)
+
+  ESC # 5
+
+  This causes the line which contains the active position to become
+  single-width single-height. The cursor remains on the same character
+  position. This is the default condition for all new lines on the screen.
+
+  DECDWL – Double-Width Line (DEC Private)
+
+  ESC # 6
+
+  This causes the line that contains the active position to become
+  double-width single-height. If the line was single width and single
+  height, all characters to the right of the screen are lost. The cursor
+  remains over the same character position unless it would be to the right
+  of the right margin, in which case, it is moved to the right margin.
+*/
+static void set_line_size(struct lw_terminal *term_emul, uint8_t size) {
+    struct lw_terminal_vt100 *vt100;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    if (*line_size(vt100, vt100->y) == size)
+        return;
+    resize_line(vt100, vt100->y, size);
+    if (size != LW_LINE_SINGLE) {
+        fill_row(vt100, vt100->width / 2, vt100->y, ' ' | vt100->attr,
+                 vt100->width - vt100->width / 2);
+        if (vt100->x >= vt100->width / 2)
+            vt100->x = vt100->width / 2 - 1;
+    }
+}
+
+static void DECDHL_top(struct lw_terminal *term_emul) {
+    set_line_size(term_emul, LW_LINE_DOUBLE_TOP);
+}
+
+static void DECDHL_bottom(struct lw_terminal *term_emul) {
+    set_line_size(term_emul, LW_LINE_DOUBLE_BOTTOM);
+}
+
+static void DECSWL(struct lw_terminal *term_emul) {
+    set_line_size(term_emul, LW_LINE_SINGLE);
+}
+
+static void DECDWL(struct lw_terminal *term_emul) {
+    set_line_size(term_emul, LW_LINE_DOUBLE_WIDTH);
+}
+
+/*
+  DECDLD – Dynamically Redefinable Character Set (DEC Private)
+
+  DCS Pfn ; Pcn ; Pe ; Pcmw ; Pss ; Pt ; Pcmh ; Pcss { Dscs
+      Sxbp1 ; Sxbp2 ; ... ; Sxbpn ST
+
+  Downloads glyphs into the soft font, starting at character position Pcn
+  (0 is ' '). Pe is 0 or 2 to erase the whole font first, 1 to erase only
+  the glyphs being loaded. Pcmw is the character cell width: 2, 3 or 4 for
+  5, 6 or 7 pixels, or 5 to 16 pixels; other values give 8. Dscs names the
+  font for SCS. Each glyph is sixels, in bands of 6 pixel rows separated by
+  '/', and the glyphs are separated by ';'. Pfn, Pss, Pt, Pcmh and Pcss are
+  ignored; there is one font, of 96 characters.
+*/
+static void DECDLD_glyph(struct lw_terminal_vt100 *vt100) {
+    struct lw_soft_font_load *load = &vt100->soft_font_load;
+
+    if (load->glyph < LW_SOFT_GLYPHS)
+        vt100->load_glyph(vt100->user_data,
+                          vt100->soft_font_base + load->glyph, load->rows,
+                          load->width);
+    load->glyph += 1;
+    load->x = 0;
+    load->band = 0;
+    load->inked = false;
+    memset(load->rows, 0, sizeof(load->rows));
+}
+
+static void DECDLD_put(struct lw_terminal *term_emul, int c) {
+    struct lw_terminal_vt100 *vt100;
+    struct lw_soft_font_load *load;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    load = &vt100->soft_font_load;
+    if (c == LW_DCS_END) {
+        if (load->inked)
+            DECDLD_glyph(vt100);
+        if (vt100->soft_font_loaded != NULL)
+            vt100->soft_font_loaded(vt100->user_data);
+    } else if (!load->named) {
+        if (c >= ' ' && c <= '/') {
+            vt100->soft_font_name[0] = c;
+        } else if (c >= '0' && c <= '~') {
+            vt100->soft_font_name[1] = c;
+            load->named = true;
+        }
+    } else if (c == ';') {
+        DECDLD_glyph(vt100);
+    } else if (c == '/') {
+        load->band += 1;
+        load->x = 0;
+    } else if (c >= '?' && c <= '~') {
+        int sixel = c - '?';
+        for (int i = 0; i < 6; i++) {
+            int y = load->band * 6 + i;
+            if ((sixel & (1 << i)) && y < LW_SOFT_GLYPH_HEIGHT && load->x < 16)
+                load->rows[y] |= 1 << load->x;
+        }
+        load->x += 1;
+        load->inked = true;
+    }
+}
+
+static void DECDLD(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+    struct lw_soft_font_load *load;
+    unsigned int pcmw;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    load = &vt100->soft_font_load;
+    if (vt100->load_glyph == NULL)
+        return;
+    pcmw = term_emul->argc > 3 ? term_emul->argv[3] : 0;
+    memset(load, 0, sizeof(*load));
+    if (pcmw >= 2 && pcmw <= 4)
+        load->width = pcmw + 3;
+    else if (pcmw >= 5 && pcmw <= 16)
+        load->width = pcmw;
+    else
+        load->width = 8;
+    if (term_emul->argc <= 2 || term_emul->argv[2] != 1) {
+        /* erase every glyph, as blank ones */
+        for (load->glyph = 0; load->glyph < LW_SOFT_GLYPHS;)
+            DECDLD_glyph(vt100);
+    }
+    load->glyph = term_emul->argc > 1 ? term_emul->argv[1] : 0;
+    vt100->soft_font_name[0] = '\0';
+    term_emul->dcs_put = DECDLD_put;
+}
+
+/*
+  SCS – Select Character Set
+
+  ESC ( Dscs (G0), ESC ) Dscs (G1)
+
+  Designates the soft font named Dscs (see DECDLD), or else the built-in
+  set: G0 is ASCII, G1 the special graphics, whatever Dscs names them.
+*/
+static void SCS(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    vt100->soft_font_designated[term_emul->state == G1SET] =
+        vt100->load_glyph != NULL &&
+        term_emul->final == vt100->soft_font_name[1] &&
+        term_emul->intermediate == vt100->soft_font_name[0];
 }
 
 /*
@@ -672,20 +1354,32 @@ static void DECALN(struct lw_terminal *term_emul) {
   without changing the column position. If the active position is at the
   bottom margin, a scroll up is performed. Format Effector
 */
+static void scroll_up(struct lw_terminal_vt100 *vt100) {
+    bool smooth = MODE_IS_SET(vt100, DECSCLM) && vt100->scroll_wait != NULL;
+
+    wait_scrolls(vt100, smooth ? SMOOTH_SCROLL_QUEUE - 1 : 0);
+    begin_commit(vt100);
+    /* only lines leaving the top of the main screen are kept */
+    rotate_rows(vt100, vt100->margin_top, vt100->margin_bottom, true,
+                vt100->margin_top == 0 && !vt100->alternate);
+    if (smooth) {
+        vt100->scroll_count++;
+        store_word(vt100, &vt100->shown.scroll_count, vt100->scroll_count);
+    }
+    end_commit(vt100);
+}
+
 static void IND(struct lw_terminal *term_emul) {
     struct lw_terminal_vt100 *vt100;
-    unsigned int x;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     if (vt100->y >= vt100->margin_bottom) {
         /* SCROLL */
-        vt100->top_line = (vt100->top_line + 1) % (vt100->height * SCROLLBACK);
-        for (x = 0; x < vt100->width; ++x)
-            set(vt100, x, vt100->margin_bottom, ' ');
-
+        scroll_up(vt100);
     } else {
         /* Do not scroll, just move downward on the current display space */
         vt100->y += 1;
+        clamp_x(vt100);
     }
 }
 /*
@@ -701,12 +1395,17 @@ static void RI(struct lw_terminal *term_emul) {
     struct lw_terminal_vt100 *vt100;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
-    if (vt100->y == 0) {
+    if (vt100->y == vt100->margin_top) {
         /* SCROLL */
-        vt100->top_line = (vt100->top_line - 1) % (vt100->height * SCROLLBACK);
-    } else {
+        wait_scrolls(vt100, 0);
+        begin_commit(vt100);
+        rotate_rows(vt100, vt100->margin_top, vt100->margin_bottom, false,
+                    false);
+        end_commit(vt100);
+    } else if (vt100->y > 0) {
         /* Do not scroll, just move upward on the current display space */
         vt100->y -= 1;
+        clamp_x(vt100);
     }
 }
 
@@ -721,14 +1420,11 @@ static void RI(struct lw_terminal *term_emul) {
 */
 static void NEL(struct lw_terminal *term_emul) {
     struct lw_terminal_vt100 *vt100;
-    unsigned int x;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     if (vt100->y >= vt100->margin_bottom) {
         /* SCROLL */
-        vt100->top_line = (vt100->top_line + 1) % (vt100->height * SCROLLBACK);
-        for (x = 0; x < vt100->width; ++x)
-            set(vt100, x, vt100->margin_bottom, ' ');
+        scroll_up(vt100);
     } else {
         /* Do not scroll, just move downward on the current display space */
         vt100->y += 1;
@@ -762,6 +1458,7 @@ static void CUU(struct lw_terminal *term_emul) {
         vt100->y -= arg0;
     else
         vt100->y = 0;
+    clamp_x(vt100);
 }
 
 /*
@@ -790,6 +1487,7 @@ static void CUD(struct lw_terminal *term_emul) {
     vt100->y += arg0;
     if (vt100->y >= vt100->height)
         vt100->y = vt100->height - 1;
+    clamp_x(vt100);
 }
 
 /*
@@ -815,8 +1513,8 @@ static void CUF(struct lw_terminal *term_emul) {
     if (arg0 == 0)
         arg0 = 1;
     vt100->x += arg0;
-    if (vt100->x >= vt100->width)
-        vt100->x = vt100->width - 1;
+    if (vt100->x >= line_width(vt100, vt100->y))
+        vt100->x = line_width(vt100, vt100->y) - 1;
 }
 
 /*
@@ -866,14 +1564,116 @@ static void DCH(struct lw_terminal *term_emul) {
     if (term_emul->argc > 0)
         arg0 = term_emul->argv[0];
 
-    for (x = vt100->x; x < vt100->width; ++x) {
-        int x1 = x + arg0;
-        if (x1 >= (int)vt100->width) {
-            set(vt100, x, y, ' ');
-        } else {
-            aset(vt100, x, y, aget(vt100, x1, y));
-        }
-    }
+    x = vt100->x;
+    if (x >= vt100->width)
+        return;
+    if (arg0 > vt100->width - x)
+        arg0 = vt100->width - x;
+    move_row(vt100, x, x + arg0, y, vt100->width - x - arg0);
+    fill_row(vt100, vt100->width - arg0, y, ' ' | vt100->attr, arg0);
+}
+
+/*
+  ICH – Insert Character
+
+  ESC [ Pn @        default value: 1
+
+  Inserts Pn blank characters at the active position. The character at
+  the active position and those to its right move right; characters
+  moved past the right margin are lost. The active position does not
+  move.
+*/
+static void ICH(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int arg0;
+    unsigned int x;
+    unsigned int y;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    arg0 = 1;
+    y = vt100->y;
+
+    if (term_emul->argc > 0)
+        arg0 = term_emul->argv[0];
+    if (arg0 == 0)
+        arg0 = 1;
+
+    x = vt100->x;
+    if (x >= vt100->width)
+        return;
+    if (arg0 > vt100->width - x)
+        arg0 = vt100->width - x;
+    move_row(vt100, x + arg0, x, y, vt100->width - x - arg0);
+    fill_row(vt100, x, y, ' ' | vt100->attr, arg0);
+}
+
+/*
+** IL and DL: rotate the rows from the cursor's to the bottom margin down (or
+** up) Pn times, each bringing in a blank line. Only the row pointers move.
+*/
+static void insert_delete_lines(struct lw_terminal *term_emul, bool up) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int arg0;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    arg0 = 1;
+    if (term_emul->argc > 0)
+        arg0 = term_emul->argv[0];
+    if (arg0 == 0)
+        arg0 = 1;
+    if (vt100->y < vt100->margin_top || vt100->y > vt100->margin_bottom)
+        return;
+    if (arg0 > vt100->margin_bottom - vt100->y + 1)
+        arg0 = vt100->margin_bottom - vt100->y + 1;
+
+    wait_scrolls(vt100, 0);
+    begin_commit(vt100);
+    while (arg0--)
+        rotate_rows(vt100, vt100->y, vt100->margin_bottom, up, false);
+    end_commit(vt100);
+    vt100->x = 0;
+}
+
+/*
+  IL – Insert Line
+
+  ESC [ Pn L        default value: 1
+
+  Inserts Pn lines at the line with the active position. Lines displayed
+  below it move down; lines moved past the bottom margin are lost. This
+  sequence is ignored when the active position is outside the scrolling
+  region. The active position moves to the first column.
+*/
+static void IL(struct lw_terminal *term_emul) {
+    insert_delete_lines(term_emul, false);
+}
+
+/*
+  DL – Delete Line
+
+  ESC [ Pn M        default value: 1
+
+  Deletes Pn lines, starting at the line with the active position. Lines
+  below them move up, and blank lines are added at the bottom margin.
+  This sequence is ignored when the active position is outside the
+  scrolling region. The active position moves to the first column.
+*/
+static void DL(struct lw_terminal *term_emul) {
+    insert_delete_lines(term_emul, true);
+}
+
+/* EL, and the cursor's line for ED */
+static void erase_in_line(struct lw_terminal_vt100 *vt100, unsigned int arg0) {
+    lw_cell_t blank = ' ' | vt100->attr;
+    /* past the last column, the cursor is still on it */
+    unsigned int x = vt100->x < vt100->width ? vt100->x : vt100->width - 1;
+
+    if (arg0 == 0)
+        fill_row(vt100, x, vt100->y, blank, vt100->width - x);
+    else if (arg0 == 1)
+        fill_row(vt100, 0, vt100->y, blank, x + 1);
+    else if (arg0 == 2)
+        fill_row(vt100, 0, vt100->y, blank, vt100->width);
 }
 
 /*
@@ -895,7 +1695,6 @@ static void DCH(struct lw_terminal *term_emul) {
 static void ED(struct lw_terminal *term_emul) {
     struct lw_terminal_vt100 *vt100;
     unsigned int arg0;
-    unsigned int x;
     unsigned int y;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
@@ -903,21 +1702,16 @@ static void ED(struct lw_terminal *term_emul) {
     if (term_emul->argc > 0)
         arg0 = term_emul->argv[0];
     if (arg0 == 0) {
-        for (x = vt100->x; x < vt100->width; ++x)
-            set(vt100, x, vt100->y, ' ');
-        for (x = 0; x < vt100->width; ++x)
-            for (y = vt100->y + 1; y < vt100->height; ++y)
-                set(vt100, x, y, ' ');
+        erase_in_line(vt100, 0);
+        for (y = vt100->y + 1; y < vt100->height; ++y)
+            erase_row(vt100, y);
     } else if (arg0 == 1) {
-        for (x = 0; x < vt100->width; ++x)
-            for (y = 0; y < vt100->y; ++y)
-                set(vt100, x, y, ' ');
-        for (x = 0; x <= vt100->x; ++x)
-            set(vt100, x, vt100->y, ' ');
+        for (y = 0; y < vt100->y; ++y)
+            erase_row(vt100, y);
+        erase_in_line(vt100, 1);
     } else if (arg0 == 2) {
-        for (x = 0; x < vt100->width; ++x)
-            for (y = 0; y < vt100->height; ++y)
-                set(vt100, x, y, ' ');
+        for (y = 0; y < vt100->height; ++y)
+            erase_row(vt100, y);
     }
 }
 
@@ -938,22 +1732,12 @@ static void ED(struct lw_terminal *term_emul) {
 static void EL(struct lw_terminal *term_emul) {
     struct lw_terminal_vt100 *vt100;
     unsigned int arg0;
-    unsigned int x;
 
     vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
     arg0 = 0;
     if (term_emul->argc > 0)
         arg0 = term_emul->argv[0];
-    if (arg0 == 0) {
-        for (x = vt100->x; x < vt100->width; ++x)
-            set(vt100, x, vt100->y, ' ');
-    } else if (arg0 == 1) {
-        for (x = 0; x <= vt100->x; ++x)
-            set(vt100, x, vt100->y, ' ');
-    } else if (arg0 == 2) {
-        for (x = 0; x < vt100->width; ++x)
-            set(vt100, x, vt100->y, ' ');
-    }
+    erase_in_line(vt100, arg0);
 }
 
 /*
@@ -972,6 +1756,33 @@ static void EL(struct lw_terminal *term_emul) {
   columns depends on the reset or set state of the origin mode
   (DECOM). Format Effector
 */
+/*
+  ECH – Erase Character
+
+  ESC [ Pn X        default value: 1
+
+  Erases Pn characters from the active position on, without moving it
+  or the rest of the line.
+*/
+static void ECH(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int arg0;
+    unsigned int x, width;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    arg0 = 1;
+    if (term_emul->argc > 0)
+        arg0 = term_emul->argv[0];
+    if (arg0 == 0)
+        arg0 = 1;
+    /* past the last column, the cursor is still on it */
+    width = line_width(vt100, vt100->y);
+    x = vt100->x < width ? vt100->x : width - 1;
+    if (arg0 > width - x)
+        arg0 = width - x;
+    fill_row(vt100, x, vt100->y, ' ' | vt100->attr, arg0);
+}
+
 static void HVP(struct lw_terminal *term_emul) { CUP(term_emul); }
 
 static void TBC(struct lw_terminal *term_emul) {
@@ -994,6 +1805,55 @@ static void HTS(struct lw_terminal *term_emul) {
     vt100->tabulations[vt100->x] = '|';
 }
 
+/*
+** Before a character is written: from just past the last column, wrap to the
+** next line with autowrap, or write over the last column again without it
+*/
+static void wrap_cursor(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    if (vt100->x == line_width(vt100, vt100->y)) {
+        if (MODE_IS_SET(vt100, DECAWM))
+            NEL(term_emul);
+        else
+            vt100->x -= 1;
+    }
+}
+
+/* The cell for graphic character c, in the character sets invoked */
+static lw_cell_t char_cell(struct lw_terminal_vt100 *vt100, int c) {
+    lw_cell_t attr = vt100->attr;
+
+    // SI invokes G0, SO G1
+    if (vt100->soft_font_designated[!vt100->selected_charset] && c > ' ' &&
+        c < 127) {
+        c = vt100->soft_font_base + c - ' ';
+    } else {
+        if (!vt100->selected_charset && c > 95 && c < 127) {
+            c = c - 95; // you can't hit the glyph at 0 this way, oh well
+        }
+        if (!vt100->unicode && !vt100->selected_charset && c > 32 &&
+            c <= 95) {
+            // extension: In the alternate character set, there are also
+            // sixels/sextant chars. Because there's only room for 32 of the
+            // 64 in the character bitmap (at 128-160) half are displayed in
+            // inverse video instead.
+            c = c + 64;
+            if (c >= 160) {
+                struct lw_parsed_attr tmp_attr = vt100->parsed_attr;
+                tmp_attr.inverse = !tmp_attr.inverse;
+                c ^= 0x1f;
+                attr = vt100->encode_attr(vt100, &tmp_attr);
+            }
+        }
+        if (c >= 0x100) {
+            c = vt100->map_unicode(vt100, c, &attr);
+        }
+    }
+    return c | attr;
+}
+
 static void vt100_write_unicode(struct lw_terminal *term_emul, int c) {
     struct lw_terminal_vt100 *vt100;
 
@@ -1015,7 +1875,7 @@ static void vt100_write_unicode(struct lw_terminal *term_emul, int c) {
         return;
     }
     if (c == '\010' && vt100->x > 0) {
-        if (vt100->x == vt100->width)
+        if (vt100->x == line_width(vt100, vt100->y))
             vt100->x -= 1;
         vt100->x -= 1;
         return;
@@ -1024,7 +1884,7 @@ static void vt100_write_unicode(struct lw_terminal *term_emul, int c) {
         do {
             set(vt100, vt100->x, vt100->y, ' ');
             vt100->x += 1;
-        } while (vt100->x < vt100->width &&
+        } while (vt100->x < line_width(vt100, vt100->y) &&
                  vt100->tabulations[vt100->x] == '-');
         return;
     }
@@ -1040,35 +1900,212 @@ static void vt100_write_unicode(struct lw_terminal *term_emul, int c) {
         return;
     }
 
-    lw_cell_t attr = vt100->attr;
+    lw_cell_t cell;
 
-    if (vt100->x == vt100->width) {
-        if (MODE_IS_SET(vt100, DECAWM))
-            NEL(term_emul);
-        else
-            vt100->x -= 1;
+    wrap_cursor(term_emul);
+    cell = char_cell(vt100, c);
+    if (MODE_IS_SET(vt100, IRM))
+        move_row(vt100, vt100->x + 1, vt100->x, vt100->y,
+                 line_width(vt100, vt100->y) - vt100->x - 1);
+    aset(vt100, vt100->x, vt100->y, cell);
+    vt100->x += 1;
+    vt100->last_printed = cell;
+}
+
+/*
+  REP – Repeat
+
+  ESC [ Pn b        default value: 1
+
+  Writes the last graphic character received Pn more times, as if each
+  had been received again. Each stretch of them along a line is written
+  as a single fill.
+*/
+static void REP(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int arg0;
+    unsigned int n;
+    unsigned int y;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    arg0 = 1;
+    if (term_emul->argc > 0)
+        arg0 = term_emul->argv[0];
+    if (arg0 == 0)
+        arg0 = 1;
+    if (vt100->last_printed < 0)
+        return;
+
+    while (arg0 > 0) {
+        wrap_cursor(term_emul);
+        y = vt100->y;
+        n = line_width(vt100, y) - vt100->x;
+        if (n > arg0)
+            n = arg0;
+        if (MODE_IS_SET(vt100, IRM))
+            move_row(vt100, vt100->x + n, vt100->x, y,
+                     line_width(vt100, y) - vt100->x - n);
+        fill_row(vt100, vt100->x, y, vt100->last_printed, n);
+        vt100->x += n;
+        arg0 -= n;
+        /* without autowrap, the rest would only overwrite the last column */
+        if (!MODE_IS_SET(vt100, DECAWM))
+            break;
     }
-    if (!vt100->selected_charset && c > 95 && c < 127) {
-        c = c - 95; // you can't hit the glyph at 0 this way, oh well
-    }
-    if (!vt100->unicode && !vt100->selected_charset && c > 32 && c <= 95) {
-        // extension: In the alternate character set, there are also
-        // sixels/sextant chars. Because there's only room for 32 of the 64
-        // in the character bitmap (at 128-160) half are displayed in
-        // inverse video instead.
-        c = c + 64;
-        if (c >= 160) {
-            struct lw_parsed_attr tmp_attr = vt100->parsed_attr;
-            tmp_attr.inverse = !tmp_attr.inverse;
-            c ^= 0x1f;
-            attr = vt100->encode_attr(vt100, &tmp_attr);
-        }
+}
+
+/* Argument i of a rectangle operation, less 1, or dflt if omitted or 0 */
+static unsigned int rect_arg(struct lw_terminal *term_emul, unsigned int i,
+                             unsigned int dflt) {
+    if (term_emul->argc > i && term_emul->argv[i] > 0)
+        return term_emul->argv[i] - 1;
+    return dflt;
+}
+
+/*
+** The rows rectangle operations may touch: within the margins in origin mode,
+** where rows are also counted from the top margin
+*/
+static void rect_rows(struct lw_terminal_vt100 *vt100, unsigned int *first,
+                      unsigned int *last) {
+    *first = 0;
+    *last = vt100->height - 1;
+    if (MODE_IS_SET(vt100, DECOM)) {
+        *first = vt100->margin_top;
+        *last = vt100->margin_bottom;
     }
-    if (c >= 0x100) {
-        c = vt100->map_unicode(vt100, c, &attr);
+}
+
+/*
+** The rectangle given by arguments i to i + 3 (Pt; Pl; Pb; Pr, the whole
+** screen by default), clipped to it. Returns false if it is empty.
+*/
+static bool rect_args(struct lw_terminal *term_emul, unsigned int i,
+                      unsigned int *top, unsigned int *left,
+                      unsigned int *bottom, unsigned int *right) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int first;
+    unsigned int last;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    rect_rows(vt100, &first, &last);
+    *top = first + rect_arg(term_emul, i, 0);
+    *left = rect_arg(term_emul, i + 1, 0);
+    *bottom = first + rect_arg(term_emul, i + 2, last - first);
+    *right = rect_arg(term_emul, i + 3, vt100->width - 1);
+    if (*bottom > last)
+        *bottom = last;
+    if (*right >= vt100->width)
+        *right = vt100->width - 1;
+    return *top <= *bottom && *left <= *right;
+}
+
+/*
+  DECFRA – Fill Rectangular Area
+
+  ESC [ Pch; Pt; Pl; Pb; Pr $ x
+
+  Fills the rectangle with top row Pt, left column Pl, bottom row Pb and
+  right column Pr with the character Pch (32 to 126 or 160 to 255) in
+  the current character set and rendition. The cursor does not move.
+*/
+static void DECFRA(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int top, left, bottom, right;
+    unsigned int c;
+    lw_cell_t cell;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    if (term_emul->intermediate != '$') {
+        if (term_emul->unimplemented != NULL)
+            term_emul->unimplemented(term_emul, "CSI", 'x');
+        return;
     }
-    aset(vt100, vt100->x, vt100->y, c | attr);
-    vt100->x += 1;
+    c = term_emul->argc > 0 ? term_emul->argv[0] : 0;
+    if (c < 32 || (c > 126 && c < 160) || c > 255)
+        return;
+    if (!rect_args(term_emul, 1, &top, &left, &bottom, &right))
+        return;
+    cell = char_cell(vt100, c);
+    begin_commit(vt100);
+    for (; top <= bottom; ++top)
+        fill_row(vt100, left, top, cell, right - left + 1);
+    end_commit(vt100);
+}
+
+/*
+  DECERA – Erase Rectangular Area
+
+  ESC [ Pt; Pl; Pb; Pr $ z
+
+  Erases the rectangle with top row Pt, left column Pl, bottom row Pb and
+  right column Pr. The cursor does not move.
+*/
+static void DECERA(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int top, left, bottom, right;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    if (term_emul->intermediate != '$') {
+        if (term_emul->unimplemented != NULL)
+            term_emul->unimplemented(term_emul, "CSI", 'z');
+        return;
+    }
+    if (!rect_args(term_emul, 0, &top, &left, &bottom, &right))
+        return;
+    begin_commit(vt100);
+    for (; top <= bottom; ++top)
+        fill_row(vt100, left, top, ' ' | vt100->attr, right - left + 1);
+    end_commit(vt100);
+}
+
+/*
+  DECCRA – Copy Rectangular Area
+
+  ESC [ Pts; Pls; Pbs; Prs; Pps; Ptd; Pld; Ppd $ v
+
+  Copies the rectangle with top row Pts, left column Pls, bottom row Pbs
+  and right column Prs to top row Ptd and left column Pld, clipped to the
+  screen. The source and destination may overlap. There is only one page,
+  so Pps and Ppd are ignored. The cursor does not move.
+*/
+static void DECCRA(struct lw_terminal *term_emul) {
+    struct lw_terminal_vt100 *vt100;
+    unsigned int top, left, bottom, right;
+    unsigned int first, last;
+    unsigned int to_top, to_left;
+    unsigned int rows, cols, k;
+
+    vt100 = (struct lw_terminal_vt100 *)term_emul->user_data;
+    if (term_emul->intermediate != '$') {
+        if (term_emul->unimplemented != NULL)
+            term_emul->unimplemented(term_emul, "CSI", 'v');
+        return;
+    }
+    if (!rect_args(term_emul, 0, &top, &left, &bottom, &right))
+        return;
+    rect_rows(vt100, &first, &last);
+    to_top = first + rect_arg(term_emul, 5, 0);
+    to_left = rect_arg(term_emul, 6, 0);
+    if (to_top > last || to_left >= vt100->width)
+        return;
+    rows = bottom - top < last - to_top ? bottom - top : last - to_top;
+    cols = right - left < vt100->width - 1 - to_left
+               ? right - left
+               : vt100->width - 1 - to_left;
+    ++rows;
+    ++cols;
+
+    begin_commit(vt100);
+    /* rows the copy overwrites are copied from before they are */
+    for (k = 0; k < rows; ++k) {
+        unsigned int y = to_top > top ? rows - 1 - k : k;
+        lw_cell_t *dst = cell_ptr(vt100, to_left, to_top + y);
+        lw_cell_t *src = cell_ptr(vt100, left, top + y);
+        if (dst != src)
+            copy(vt100, dst, src, cols, to_top + y);
+    }
+    end_commit(vt100);
 }
 
 #define REPLACEMENT ('?')
@@ -1116,18 +2153,86 @@ static void vt100_write(struct lw_terminal *term_emul, char c) {
     }
 }
 
-#if defined(PICO_BUILD)
-#include "pico.h"
-#else
-#define __not_in_flash_func(x) x
-#endif
 const lw_cell_t *
 __not_in_flash_func(lw_terminal_vt100_getline)(struct lw_terminal_vt100 *vt100,
                                                unsigned int y) {
-    if (y < vt100->margin_top || y > vt100->margin_bottom)
-        return vt100->afrozen_screen + FROZEN_SCREEN_PTR(vt100, 0, y);
-    else
-        return vt100->ascreen + SCREEN_PTR(vt100, 0, y);
+    return vt100->row_cells[y];
+}
+
+/*
+** The line the renderer shows on row k of the scroll region (or just below it,
+** for k = its height) as it was `pending` scrolls ago
+*/
+static unsigned int __not_in_flash_func(region_line)(
+    struct lw_terminal_vt100 *vt100, unsigned int k, unsigned int pending) {
+    if (k < pending)
+        return vt100->shown_scrolled[(vt100->shown_scrolls - (pending - k)) &
+                                     (SMOOTH_SCROLL_QUEUE - 1)];
+    return vt100->shown_rows[vt100->shown.margin_top + k - pending];
+}
+
+/* The line k lines back in the scrollback, from 1 for the newest */
+static unsigned int __not_in_flash_func(history_line)(
+    struct lw_terminal_vt100 *vt100, unsigned int k) {
+    unsigned int next = vt100->shown_history_next;
+    if (next < k)
+        next += vt100->shown.history;
+    return vt100->shown_history[next - k];
+}
+
+/*
+** Fill snapshot->lines[0 .. height-1] with the display rows as the ops applied
+** so far leave them. With ops, call it from the thread that calls
+** lw_terminal_vt100_apply; everything between a begin_commit and an end_commit
+** is applied together, so the rows are always those of a completed commit.
+**
+** The scroll region is shown as it was before the smooth scrolls the
+** renderer hasn't animated yet (shown.scroll_count - scroll_done of them).
+**
+** With scrollback, the screen is shown that many lines down, below the
+** newest lines of the scrollback (no more than it has), and with no smooth
+** scrolls pending; snapshot->scrollback is the number shown. Only the
+** renderer's side of the scrollback is read, so the emulator can go on
+** meanwhile.
+*/
+void __not_in_flash_func(lw_terminal_vt100_snapshot)(
+    struct lw_terminal_vt100 *vt100,
+    struct lw_terminal_vt100_snapshot *snapshot, unsigned int scroll_done,
+    unsigned int scrollback) {
+    const struct lw_terminal_vt100_view *view = &vt100->shown;
+    unsigned int pending = view->scroll_count - scroll_done;
+    unsigned int y;
+
+    if (scrollback > vt100->shown_saved)
+        scrollback = vt100->shown_saved;
+    if (scrollback)
+        pending = 0;
+    for (y = 0; y < view->height; ++y) {
+        unsigned int line;
+        if (y < scrollback) {
+            line = history_line(vt100, scrollback - y);
+        } else {
+            line = vt100->shown_rows[y - scrollback];
+            if (pending && y >= view->margin_top && y <= view->margin_bottom)
+                line = region_line(vt100, y - view->margin_top, pending);
+        }
+        snapshot->lines[y] = vt100->ascreen + line * view->width;
+        snapshot->line_size[y] = vt100->shown_line_size[line];
+    }
+    if (pending) {
+        unsigned int line = region_line(
+            vt100, view->margin_bottom + 1 - view->margin_top, pending);
+        snapshot->incoming = vt100->ascreen + line * view->width;
+        snapshot->incoming_size = vt100->shown_line_size[line];
+    } else {
+        snapshot->incoming = NULL;
+        snapshot->incoming_size = LW_LINE_SINGLE;
+    }
+    snapshot->width = view->width;
+    snapshot->margin_top = view->margin_top;
+    snapshot->margin_bottom = view->margin_bottom;
+    snapshot->scroll_pending = pending;
+    snapshot->scrollback = scrollback;
 }
 
 const lw_cell_t **lw_terminal_vt100_getlines(struct lw_terminal_vt100 *vt100) {
@@ -1149,7 +2254,7 @@ struct lw_terminal_vt100 *lw_terminal_vt100_init(
     void (*master_write)(void *user_data, void *buffer, size_t len),
     lw_cell_t (*encode_attr)(void *user_data,
                              const struct lw_parsed_attr *attr),
-    unsigned int width, unsigned int height) {
+    unsigned int width, unsigned int height, unsigned int history) {
     struct lw_terminal_vt100 *this;
 
     this = calloc(1, sizeof(*this));
@@ -1157,16 +2262,37 @@ struct lw_terminal_vt100 *lw_terminal_vt100_init(
         return NULL;
     this->user_data = user_data;
     this->height = height;
+    this->max_height = height;
+    /* the main and alternate screens, their spare lines, and the scrollback */
+    if (LW_SCREEN_LINES(height) > LW_POOL_LINES_MAX)
+        goto free_this;
+    /* smooth scrolling shows lines after they have gone to the scrollback */
+    if (history && history < SMOOTH_SCROLL_QUEUE)
+        history = SMOOTH_SCROLL_QUEUE;
+    if (history > LW_POOL_LINES_MAX - LW_SCREEN_LINES(height))
+        history = LW_POOL_LINES_MAX - LW_SCREEN_LINES(height);
+    if (history < SMOOTH_SCROLL_QUEUE)
+        history = 0;
+    this->pool_lines = LW_SCREEN_LINES(height) + history;
     this->width = width;
-    this->ascreen = malloc(132 * SCROLLBACK * this->height * sizeof(lw_cell_t));
+    this->ascreen = malloc(132 * this->pool_lines * sizeof(lw_cell_t));
     if (this->ascreen == NULL)
         goto free_this;
-    this->afrozen_screen = malloc(132 * this->height * sizeof(lw_cell_t));
-    if (this->afrozen_screen == NULL)
+    this->aline_size = calloc(this->pool_lines, 1);
+    if (this->aline_size == NULL)
         goto free_screen;
+    this->shown_line_size = calloc(this->pool_lines, 1);
+    if (this->shown_line_size == NULL)
+        goto free_line_size;
+    this->free_lines = malloc(this->pool_lines);
+    if (this->free_lines == NULL)
+        goto free_shown_line_size;
+    this->shown_history = malloc(this->pool_lines);
+    if (this->shown_history == NULL)
+        goto free_free_lines;
     this->tabulations = malloc(132);
     if (this->tabulations == NULL)
-        goto free_frozen_screen;
+        goto free_shown_history;
     for (int i = 0; i < 132; i++) {
         this->tabulations[i] = (i && i % 8 == 0) ? '|' : '-';
     }
@@ -1175,8 +2301,14 @@ struct lw_terminal_vt100 *lw_terminal_vt100_init(
     this->selected_charset = 1;
     this->x = 0;
     this->y = 0;
-    this->modes = MASK_DECANM;
-    this->top_line = 0;
+    this->modes = MASK_DECANM | MASK_DECTCEM;
+    /* The modes follow the power-on width, as if DECCOLM had set it */
+    if (width > 80)
+        this->modes |= MASK_DECCOLM;
+    this->cursor_style = 1;
+    this->last_printed = -1;
+    home_rows(this);
+    this->ops_run = -1;
     this->lw_terminal = lw_terminal_parser_init();
     if (this->lw_terminal == NULL)
         goto free_tabulations;
@@ -1196,15 +2328,31 @@ struct lw_terminal_vt100 *lw_terminal_vt100_init(
     this->lw_terminal->callbacks.csi.m = SGR;
     this->lw_terminal->callbacks.csi.A = CUU;
     this->lw_terminal->callbacks.csi.P = DCH;
+    this->lw_terminal->callbacks.csi.h40 = ICH;
+    this->lw_terminal->callbacks.csi.L = IL;
+    this->lw_terminal->callbacks.csi.M = DL;
+    this->lw_terminal->callbacks.csi.X = ECH;
+    this->lw_terminal->callbacks.csi.b = REP;
+    this->lw_terminal->callbacks.csi.x = DECFRA;
+    this->lw_terminal->callbacks.csi.z = DECERA;
+    this->lw_terminal->callbacks.csi.v = DECCRA;
     this->lw_terminal->callbacks.csi.g = TBC;
     this->lw_terminal->callbacks.esc.H = HTS;
     this->lw_terminal->callbacks.csi.D = CUB;
+    this->lw_terminal->callbacks.csi.q = DECSCUSR;
     this->lw_terminal->callbacks.esc.E = NEL;
     this->lw_terminal->callbacks.esc.D = IND;
     this->lw_terminal->callbacks.esc.M = RI;
     this->lw_terminal->callbacks.esc.n8 = DECRC;
     this->lw_terminal->callbacks.esc.n7 = DECSC;
+    this->lw_terminal->callbacks.hash.n3 = DECDHL_top;
+    this->lw_terminal->callbacks.hash.n4 = DECDHL_bottom;
+    this->lw_terminal->callbacks.hash.n5 = DECSWL;
+    this->lw_terminal->callbacks.hash.n6 = DECDWL;
     this->lw_terminal->callbacks.hash.n8 = DECALN;
+    this->lw_terminal->callbacks.dcs.h7B = DECDLD;
+    for (int i = 0; i <= '~' - '0'; i++)
+        ((term_action *)&this->lw_terminal->callbacks.scs)[i] = SCS;
     this->lw_terminal->unimplemented = unimplemented;
     this->master_write = master_write;
     this->encode_attr = encode_attr ? encode_attr : default_encode_attr;
@@ -1212,13 +2360,19 @@ struct lw_terminal_vt100 *lw_terminal_vt100_init(
     this->map_unicode = default_map_unicode;
     lw_terminal_vt100_read_str(this,
                                "\033[m\033[?7h"); // set default attributes
-    setcells(this->ascreen, ' ' | this->attr, 132 * SCROLLBACK * this->height);
-    setcells(this->afrozen_screen, ' ' | this->attr, 132 * this->height);
+    setcells(this->ascreen, ' ' | this->attr, 132 * this->pool_lines);
+    show_view(this);
     return this;
 free_tabulations:
     free(this->tabulations);
-free_frozen_screen:
-    free(this->afrozen_screen);
+free_shown_history:
+    free(this->shown_history);
+free_free_lines:
+    free(this->free_lines);
+free_shown_line_size:
+    free(this->shown_line_size);
+free_line_size:
+    free(this->aline_size);
 free_screen:
     free(this->ascreen);
 free_this:
@@ -1226,31 +2380,24 @@ free_this:
     return NULL;
 }
 
-#define CURSOR_ATTR (7 << 11) // very specific to cr100
-static void show_cursor(struct lw_terminal_vt100 *this) {
+/*
+** Publish the cursor for the renderer, which draws it over the screen, along
+** with the changes to the screen
+*/
+static void update_cursor(struct lw_terminal_vt100 *this) {
     unsigned x = this->x, y = this->y;
-    lw_cell_t cell;
-    if (x == this->width)
-        x -= 1;
-    if (x >= this->width || y >= this->height) {
-        this->cursor_saved_flag = false;
-        return;
-    }
-
-    cell = aget(this, x, y);
-    this->cursor_saved_x = x;
-    this->cursor_saved_y = y;
-    this->cursor_saved_flag = true;
-    aset(this, x, y, cell ^ CURSOR_ATTR);
-}
-
-static void hide_cursor(struct lw_terminal_vt100 *this) {
-    if (!this->cursor_saved_flag) {
-        return;
+    uint32_t cursor;
+    if (y < this->height && x >= line_width(this, y))
+        x = line_width(this, y) - 1;
+    if (x >= this->width || y >= this->height || !MODE_IS_SET(this, DECTCEM))
+        cursor = LW_CURSOR_HIDDEN;
+    else
+        cursor = LW_CURSOR_POS(x, y);
+    if (cursor != this->queued_cursor) {
+        this->queued_cursor = cursor;
+        store_word(this, &this->cursor, cursor);
     }
-    this->cursor_saved_flag = false;
-    unsigned x = this->cursor_saved_x, y = this->cursor_saved_y;
-    aset(this, x, y, aget(this, x, y) ^ CURSOR_ATTR);
+    publish_ops(this);
 }
 
 void lw_terminal_vt100_read_str(struct lw_terminal_vt100 *this,
@@ -1260,15 +2407,24 @@ void lw_terminal_vt100_read_str(struct lw_terminal_vt100 *this,
 
 void lw_terminal_vt100_read_buf(struct lw_terminal_vt100 *this,
                                 const char *buffer, size_t len) {
-    hide_cursor(this);
     lw_terminal_parser_read_buf(this->lw_terminal, buffer, len);
-    show_cursor(this);
+    update_cursor(this);
+}
+
+void lw_terminal_vt100_set_height(struct lw_terminal_vt100 *this,
+                                  unsigned int height) {
+    if (height > this->max_height)
+        height = this->max_height;
+    reset_screen(this, this->width, height);
 }
 
 void lw_terminal_vt100_destroy(struct lw_terminal_vt100 *this) {
     lw_terminal_parser_destroy(this->lw_terminal);
     free(this->tabulations);
+    free(this->aline_size);
+    free(this->shown_line_size);
+    free(this->free_lines);
+    free(this->shown_history);
     free(this->ascreen);
-    free(this->afrozen_screen);
     free(this);
 }
@@ -37,7 +37,30 @@
  * It's a vt100 implementation, that implements ANSI control function.
  */
 
-#define SCROLLBACK 3
+/*
+** Smooth (DECSCLM) scrolls that may be queued ahead of the renderer, a power
+** of two
+*/
+#define SMOOTH_SCROLL_QUEUE 4
+/*
+** Lines are numbered in a byte, so the screens and the scrollback together
+** are at most this many
+*/
+#define LW_POOL_LINES_MAX 256
+/* The lines of the main and alternate screens, with their spare lines */
+#define LW_SCREEN_LINES(height) (2 * (height) + 2 * SMOOTH_SCROLL_QUEUE)
+/*
+** Room kept in the op queue for a scroll, margin or screen size change, so
+** that the renderer never sees part of one; inserting or deleting every line
+** of the screen takes three ops a line
+*/
+#define LW_OPS_PER_COMMIT (3 * 80 + 16)
+/*
+** The changes lw_terminal_vt100_apply makes in a call, in cells (see
+** LW_OP_COMMIT), unless the first commit alone is more: about 10 scanlines'
+** time, so that the changes of a frame are made well within vertical blanking
+*/
+#define LW_APPLY_CELLS 8192
 
 #define MASK_LNM 1
 #define MASK_DECCKM 2
@@ -49,8 +72,13 @@
 #define MASK_DECAWM 128
 #define MASK_DECARM 256
 #define MASK_DECINLM 512
+#define MASK_DECTCEM 1024
+#define MASK_IRM 2048
 
-#define LNM 20
+/* ANSI modes, set without the ? flag, are numbered apart from the DEC ones */
+#define ANSI_MODE(n) (0x100 | (n))
+#define LNM ANSI_MODE(20)
+#define IRM ANSI_MODE(4)
 #define DECCKM 1
 #define DECANM 2
 #define DECCOLM 3
@@ -60,6 +88,14 @@
 #define DECAWM 7
 #define DECARM 8
 #define DECINLM 9
+#define DECTCEM 25
+/*
+** The alternate screen (xterm): plain, cleared on leaving it, or cleared on
+** entering it with the cursor saved
+*/
+#define ALT_SCREEN 47
+#define ALT_SCREEN_CLEAR 1047
+#define ALT_SCREEN_SAVE_CURSOR 1049
 
 #define SET_MODE(vt100, mode) ((vt100)->modes |= get_mode_mask(mode))
 #define UNSET_MODE(vt100, mode) ((vt100)->modes &= ~get_mode_mask(mode))
@@ -67,57 +103,267 @@
 
 typedef uint16_t lw_cell_t;
 
+#define LW_CURSOR_POS(x, y) ((uint32_t)(y) << 16 | (x))
+#define LW_CURSOR_X(cursor) ((cursor)&0xffff)
+#define LW_CURSOR_Y(cursor) ((cursor) >> 16)
+#define LW_CURSOR_HIDDEN (0xffffffff)
+
+/*
+** Line sizes set by DECSWL, DECDWL and DECDHL. Double-width lines show the
+** first half of their cells; double-height lines are also double width, and
+** come in pairs of a top and a bottom half.
+*/
+enum lw_line_size {
+    LW_LINE_SINGLE,
+    LW_LINE_DOUBLE_WIDTH,
+    LW_LINE_DOUBLE_TOP,
+    LW_LINE_DOUBLE_BOTTOM,
+};
+
 struct lw_parsed_attr {
     uint8_t fg, bg;
-    bool blink, bold, inverse;
+    bool blink, bold, inverse, underline, strike;
+};
+
+#define LW_DEFAULT_ATTR                                                        \
+    ((struct lw_parsed_attr){7, 0, false, false, false, false, false})
+
+/* DECDLD: a soft font has a glyph for each character from ' ' to DEL */
+#define LW_SOFT_GLYPHS (96)
+/* The pixel rows of a soft glyph the emulator keeps: 2 sixel bands */
+#define LW_SOFT_GLYPH_HEIGHT (12)
+
+/* A DECDLD download in progress */
+struct lw_soft_font_load {
+    int glyph;   /* The character position (0-95) being received */
+    int x, band; /* The sixel column, and the band of 6 rows */
+    int width;   /* The character cell width in pixels */
+    bool named;  /* Whether the Dscs has been received */
+    bool inked;  /* Whether the glyph has any sixel data yet */
+    uint16_t rows[LW_SOFT_GLYPH_HEIGHT]; /* bit 0 is the leftmost pixel */
+};
+
+/*
+** A change to the screen, queued by the emulator for lw_terminal_vt100_apply
+** (see lw_terminal_vt100::ops). Each also marks its display row changed, or
+** all of them (LW_OP_ALL_ROWS), or none (LW_OP_NO_ROW).
+*/
+enum lw_op_kind {
+    LW_OP_FILL,  /* count cells at dst = arg.cells[0] */
+    LW_OP_PUT,   /* count cells at dst = arg.cells, up to LW_OP_PUT_MAX */
+    LW_OP_COPY,  /* count cells at dst = arg.src, which may overlap */
+    LW_OP_BYTES, /* count bytes at dst = arg.value */
+    LW_OP_WORD,  /* the uint32_t at dst = arg.value */
+    LW_OP_DIRTY, /* only mark rows changed */
+    /*
+    ** Move the count display rows at dst (lines of shown_rows) up one, or
+    ** down with LW_OP_SCROLL_DOWN, the line arg.value coming in. With
+    ** LW_OP_SCROLL_SAVE, the line going out goes to the scrollback, at
+    ** shown_history[arg.value >> 16].
+    */
+    LW_OP_SCROLL,
+    /*
+    ** The count ops that follow are a commit, to be applied together; they
+    ** change arg.value cells. Every other op changes count + 1 cells.
+    */
+    LW_OP_COMMIT,
 };
 
-#define LW_DEFAULT_ATTR ((struct lw_parsed_attr){7, 0, false, false, false})
+#define LW_OP_SCROLL_DOWN 0x100
+#define LW_OP_SCROLL_SAVE 0x200
+#define LW_OP_PUT_MAX 4
+#define LW_OP_ALL_ROWS 0xfe
+#define LW_OP_NO_ROW 0xff
+
+struct lw_op {
+    uint8_t kind;
+    uint8_t row;
+    uint16_t count;
+    void *dst;
+    union {
+        lw_cell_t cells[LW_OP_PUT_MAX];
+        const lw_cell_t *src;
+        uint32_t value;
+    } arg;
+};
+
+/* What the renderer shows, as of the last op applied */
+struct lw_terminal_vt100_view {
+    uint32_t width, height;
+    uint32_t margin_top, margin_bottom;
+    uint32_t scroll_count;
+    uint32_t history; /* The lines the scrollback holds */
+};
 
 /*
-** frozen_screen is the frozen part of the screen
-** when margins are set.
-** The top of the frozen_screen holds the top margin
-** while the bottom holds the bottom margin.
+** The screen is a pool of pool_lines lines, `width` cells apart in ascreen.
+** rows maps each display row to its line, and scrolls (within the margins or
+** not) only move rows along, bringing in a blank line: the oldest of the
+** spare_lines, which the line leaving takes the place of. There are enough of
+** them that smooth scrolling can still show the lines that left. Lines
+** scrolled off the top of the main screen go to the scrollback instead, a
+** ring (free_lines) from which the oldest line is taken just the same.
+**
+** The main and the alternate screen each have their own rows and spare lines
+** in the pool, and switching between them exchanges the two (other_rows and
+** other_spare_*), so neither is ever copied.
 */
 struct lw_terminal_vt100 {
     struct lw_terminal *lw_terminal;
     int ustate, ubits;
     unsigned int width;
     unsigned int height;
+    /* The lines allocated, see lw_terminal_vt100_set_height */
+    unsigned int max_height;
+    unsigned int pool_lines;
     unsigned int x;
     unsigned int y;
     unsigned int saved_x;
     unsigned int saved_y;
     unsigned int margin_top;
     unsigned int margin_bottom;
-    unsigned int top_line; /* Line at the top of the display */
+    /*
+    ** Smooth scrolls performed by the emulator, and animated by the
+    ** renderer. The renderer shows the scroll region as it was
+    ** shown.scroll_count - scroll_done scrolls ago.
+    */
+    unsigned int scroll_count;
+    volatile unsigned int scroll_done;
     lw_cell_t *ascreen;
-    lw_cell_t *afrozen_screen;
+    /* The lw_line_size of each line of ascreen */
+    uint8_t *aline_size;
+    /*
+    ** The line of each display row, and its cells. Scrolls move the entries
+    ** along, so writes never work out where a row is.
+    */
+    uint8_t rows[80];
+    lw_cell_t *row_cells[80];
+    uint8_t spare_lines[SMOOTH_SCROLL_QUEUE];
+    unsigned int spare_next;
+    /*
+    ** The scrollback, a ring of free_count lines that is always full: the
+    ** oldest (next to be reused) is at free_next
+    */
+    uint8_t *free_lines;
+    unsigned int free_count;
+    unsigned int free_next;
+    /* The screen not shown, main or alternate */
+    bool alternate;
+    uint8_t other_rows[80];
+    uint8_t other_spare_lines[SMOOTH_SCROLL_QUEUE];
+    unsigned int other_spare_next;
+    /*
+    ** With ops, the emulator doesn't change the screen itself: it queues
+    ** every change for lw_terminal_vt100_apply, which the renderer calls
+    ** between frames on its own core. ops is a single-producer,
+    ** single-consumer ring of ops_size entries; the emulator fills it at
+    ** ops_end, and hands entries over a batch at a time by advancing
+    ** ops_head, while the renderer applies them up to there from ops_tail.
+    ** Without ops, changes are made immediately.
+    */
+    struct lw_op *ops;
+    unsigned int ops_size;
+    volatile unsigned int ops_head, ops_tail;
+    unsigned int ops_end;
+    int ops_run; /* The entry still being extended by aset, or -1 */
+    unsigned int commit_op; /* The LW_OP_COMMIT of the commit being queued */
+    /*
+    ** The renderer's side of the fields above, changed only by ops: the
+    ** emulator's own may be ahead of them
+    */
+    struct lw_terminal_vt100_view shown;
+    uint8_t *shown_line_size;
+    uint8_t shown_rows[80];
+    /* The last lines scrolled up out of a region, for smooth scrolling */
+    uint8_t shown_scrolled[SMOOTH_SCROLL_QUEUE];
+    unsigned int shown_scrolls;
+    /*
+    ** The scrollback as of the last op applied: free_lines, of which the
+    ** last shown_saved (at most shown.history) before shown_history_next
+    ** have been scrolled off the screen since it was last cleared
+    */
+    uint8_t *shown_history;
+    uint32_t shown_saved;
+    uint32_t shown_history_next;
     char *tabulations;
     bool unicode;
-    bool cursor_saved_flag;
     unsigned int selected_charset;
     unsigned int modes;
     struct lw_parsed_attr parsed_attr;
     lw_cell_t attr;
-    int cursor_saved_x, cursor_saved_y;
+    /* The cell last written by a graphic character, for REP, or -1 */
+    int32_t last_printed;
+    /*
+    ** The cursor as the renderer should draw it: LW_CURSOR_POS(x, y), or
+    ** LW_CURSOR_HIDDEN. Only updated at the end of
+    ** lw_terminal_vt100_read_buf, never in the screen itself; queued_cursor
+    ** is the last one queued.
+    */
+    volatile uint32_t cursor;
+    uint32_t queued_cursor;
+    volatile uint8_t cursor_style; /* DECSCUSR parameter */
     const lw_cell_t *alines[80];
+    /* Nonzero for each display row changed since the renderer cleared it */
+    volatile uint8_t dirty[80];
     void (*master_write)(void *user_data, void *buffer, size_t len);
     void (*do_bell)(void *user_data);
+    /*
+    ** Called repeatedly while waiting for the renderer to animate queued
+    ** smooth scrolls, or to make room in ops. Without it, DECSCLM scrolls
+    ** jump like the others.
+    */
+    void (*scroll_wait)(void *user_data);
     lw_cell_t (*encode_attr)(void *user_data,
                              const struct lw_parsed_attr *attr);
     int (*map_unicode)(void *user_data, int c, lw_cell_t *attr);
+    /*
+    ** DECDLD soft font: its glyphs are the cells soft_font_base + 0 to 95.
+    ** load_glyph receives each downloaded glyph, `width` pixels wide, and
+    ** soft_font_loaded is called at the end of each download. Without
+    ** load_glyph, downloads are ignored.
+    */
+    int soft_font_base;
+    void (*load_glyph)(void *user_data, int glyph, const uint16_t *rows,
+                       int width);
+    void (*soft_font_loaded)(void *user_data);
+    char soft_font_name[2]; /* The Dscs: intermediate (or 0), final */
+    bool soft_font_designated[2]; /* Into G0, G1 by SCS */
+    struct lw_soft_font_load soft_font_load;
     void *user_data;
 };
 
+/*
+** The display rows as the renderer should draw them, from
+** lw_terminal_vt100_snapshot
+*/
+struct lw_terminal_vt100_snapshot {
+    const lw_cell_t *lines[80];
+    /* The line length, 80 or 132 (DECCOLM) */
+    unsigned int width;
+    unsigned int margin_top, margin_bottom;
+    /* Smooth scrolls not yet animated, see scroll_count */
+    unsigned int scroll_pending;
+    /* The lines of scrollback shown above the screen, pushing it down */
+    unsigned int scrollback;
+    /* With scroll_pending, the line scrolling in below the scroll region */
+    const lw_cell_t *incoming;
+    /* The lw_line_size of each of lines, and of incoming */
+    uint8_t line_size[80];
+    uint8_t incoming_size;
+};
+
+/*
+** A terminal of up to height lines, keeping history lines of scrollback at
+** that height (none, or at least SMOOTH_SCROLL_QUEUE; as many as fit in
+** LW_POOL_LINES_MAX; and more at smaller heights)
+*/
 struct lw_terminal_vt100 *lw_terminal_vt100_init(
     void *user_data,
     void (*unimplemented)(struct lw_terminal *term_emul, char *seq, char chr),
     void (*master_write)(void *user_data, void *buffer, size_t len),
     lw_cell_t (*encode_attr)(void *user_data,
                              const struct lw_parsed_attr *attr),
-    unsigned int width, unsigned int height);
+    unsigned int width, unsigned int height, unsigned int history);
 char lw_terminal_vt100_get(struct lw_terminal_vt100 *vt100, unsigned int x,
                            unsigned int y);
 lw_cell_t lw_terminal_vt100_aget(struct lw_terminal_vt100 *vt100,
@@ -125,6 +371,17 @@ lw_cell_t lw_terminal_vt100_aget(struct lw_terminal_vt100 *vt100,
 const lw_cell_t *lw_terminal_vt100_getline(struct lw_terminal_vt100 *vt100,
                                            unsigned y);
 const lw_cell_t **lw_terminal_vt100_getlines(struct lw_terminal_vt100 *vt100);
+void lw_terminal_vt100_snapshot(struct lw_terminal_vt100 *vt100,
+                                struct lw_terminal_vt100_snapshot *snapshot,
+                                unsigned int scroll_done,
+                                unsigned int scrollback);
+void lw_terminal_vt100_apply(struct lw_terminal_vt100 *vt100);
+/*
+** Change the number of lines, up to the height given to
+** lw_terminal_vt100_init, clearing the screen as DECCOLM does
+*/
+void lw_terminal_vt100_set_height(struct lw_terminal_vt100 *this,
+                                  unsigned int height);
 void lw_terminal_vt100_destroy(struct lw_terminal_vt100 *this);
 void lw_terminal_vt100_read_str(struct lw_terminal_vt100 *this,
                                 const char *buffer);
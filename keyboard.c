@@ -60,6 +60,14 @@ static bool write_expect_fa(int value, const char *msg) {
     kbd_write_blocking(value);
     return expect(0xfa, msg);
 }
+// Keep the state machine at 300kHz after the system clock changes, as
+// atkbd_program_init sets it up
+void keyboard_clock_changed(void) {
+    if (kbd_pio) {
+        pio_sm_set_clkdiv(kbd_pio, kbd_sm, clock_get_hz(clk_sys) / 100000);
+    }
+}
+
 bool keyboard_setup(PIO pio) {
     DEBUG("pre-waiting for keyboard to boot\r");
     sleep_ms(1600);
@@ -404,6 +412,17 @@ static void queue_handle_event(queue_t *q, bool release, int value) {
             if (sym == F3) {
                 queue_add_data(q, CMD_SWITCH_SETTINGS);
             }
+            if (sym == F4) {
+                queue_add_data(q, CMD_SWITCH_VIDEO);
+            }
+            return;
+        }
+        if (is_shift && sym == PAGEUP) {
+            queue_add_data(q, CMD_SCROLLBACK_UP);
+            return;
+        }
+        if (is_shift && sym == PAGEDOWN) {
+            queue_add_data(q, CMD_SCROLLBACK_DOWN);
             return;
         }
         queue_add_str(q, symtab[kc & 0x7fff]);
@@ -8,11 +8,15 @@ enum {
     CMD_SWITCH_RATE,
     CMD_SWITCH_SETTINGS,
     CMD_REBOOT,
+    CMD_SWITCH_VIDEO,
+    CMD_SCROLLBACK_UP,
+    CMD_SCROLLBACK_DOWN,
 };
 
 extern bool keyboard_setup(PIO pio);
 extern void keyboard_poll(queue_t *q);
 extern void keyboard_set_leds(int value);
+extern void keyboard_clock_changed(void);
 extern void atkbd_program_init(PIO pio, int sm, int offset, int base_pin);
 enum { LED_NUM = 2, LED_CAPS = 4 };
 extern int keyboard_leds;
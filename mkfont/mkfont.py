@@ -30,9 +30,10 @@ class OffsetBitmap:
 
 
 CHAR_COUNT = 512
+GLYPH_WIDTH = 5  # columns read from the BDF
 
 
-def main(bdf, header):
+def main(bdf, header, cell_width=GLYPH_WIDTH):
     font = bitmap_font.load_font(bdf, Bitmap)
     width, height, dx, dy = font.get_bounding_box()
 
@@ -41,6 +42,18 @@ def main(bdf, header):
 
     output_data = array.array("H", [0] * 9 * CHAR_COUNT)
 
+    # Each pixel is doubled into 2 bits, leftmost pixel in the most
+    # significant bits; 5-pixel glyphs are left 2 places up to line up with the
+    # 30-bit FIFO words (see mkscan.py). Wider cells stretch the glyph's
+    # columns across the cell, so that lines and blocks still meet their
+    # neighbors.
+    glyph_shift = min(2, 16 - 2 * cell_width)
+    if glyph_shift < 0:
+        raise SystemExit(f"{cell_width}-pixel glyphs don't fit in 16 bits")
+    columns = [
+        (x * GLYPH_WIDTH + GLYPH_WIDTH - 1) // cell_width for x in range(cell_width)
+    ]
+
     font.load_glyphs(range(CHAR_COUNT))
 
     for i in range(CHAR_COUNT):
@@ -50,16 +63,19 @@ def main(bdf, header):
         bitmap = OffsetBitmap(dx, dy, g)
         for j in range(9):
             d = extract_deposit_bits(
-                (bitmap[4, j], 0, 1),
-                (bitmap[3, j], 2, 3),
-                (bitmap[2, j], 4, 5),
-                (bitmap[1, j], 6, 7),
-                (bitmap[0, j], 8, 9),
+                *(
+                    (bitmap[c, j], 2 * (cell_width - 1 - x), 2 * (cell_width - x) - 1)
+                    for x, c in enumerate(columns)
+                )
             )
-            output_data[j * CHAR_COUNT + i] = d << 2
+            output_data[j * CHAR_COUNT + i] = d << glyph_shift
     for x in output_data:
         print(f"0x{x:04x},", file=header)
 
 
 if __name__ == "__main__":
-    main(sys.argv[1], open(sys.argv[2], "w", encoding="utf-8"))
+    main(
+        sys.argv[1],
+        open(sys.argv[2], "w", encoding="utf-8"),
+        *(int(arg) for arg in sys.argv[3:]),
+    )
@@ -0,0 +1,279 @@
+#!/usr/bin/env python
+"""Generate the fully unrolled scanline kernels used by scan_convert.h
+
+Each kernel is specialized for a number of columns, a glyph width and a FIFO
+drain interval (the number of words between FIFO_WAITs when the kernel writes
+the pixel FIFO directly). Text narrower than the line is centered between black
+margins. The per-step macros (READ_CHARDATA, ONE_CHAR, SPLIT_CHAR,
+WRITE_PIXDATA, FIFO_WAIT, SCANLINE_SETUP) are defined by scan_convert.h, and
+the kernels are listed in scan_geometries for the renderer to choose from.
+
+Each geometry also has a kernel for double-width (DECDWL/DECDHL) rows, which
+draws the first half of the cells with every pixel doubled (ONE_WIDE_CHAR,
+SPLIT_WIDE_CHAR).
+
+The estimated cost of every kernel is checked against the time the pixel state
+machine takes to drain what it produces; generation fails if it doesn't fit.
+"""
+
+import io
+import sys
+
+from dataclasses import dataclass
+
+# The pixel state machine's geometry, see vgamode.py
+LINE_PIXELS = 660
+PIXELS_PER_WORD = 15
+CYCLES_PER_PIXEL = 6
+FIFO_DEPTH = 8
+FIFO_LOW_WATER = 2  # FIFO_WAIT waits for the FIFO to drain to this level
+
+# Approximate Cortex-M0+ cycle costs of each kernel step, counted from the
+# instruction sequences gcc -O2 emits for them. These are also the defaults
+# used by the host benchmark (scanbench.c). The kernels are checked against the
+# table lookup costs without ROW_DECODE, which the direct-to-FIFO mode always
+# builds with; ROW_DECODE and the interpolator steps (INTERP_*) are cheaper.
+CYCLES = {
+    "ONE_CHAR": 13,
+    "SPLIT_CHAR": 4,  # in addition to ONE_CHAR
+    "READ_CHARDATA": 2,
+    "WRITE_PIXDATA": 2,
+    "FIFO_POLL": 7,
+    "INTERP_SETUP": 4,
+    "INTERP_ONE_CHAR": 10,
+    "INTERP_READ_CHARDATA": 4,
+    "DECODE_PAIR": 20,  # per pair of cells, once per text row
+    "ATTR_LOOKUP": 3,  # indexing the attribute table, without ROW_DECODE
+    "WIDEN": 10,  # doubling a glyph's pixels, in addition to ONE_CHAR
+}
+
+
+@dataclass(frozen=True)
+class Kernel:
+    columns: int
+    glyph_width: int
+    fifo_words: int
+    # draw every pixel twice, from a 32-bit widened glyph
+    wide: bool = False
+
+    @property
+    def name(self):
+        suffix = "_wide" if self.wide else ""
+        return f"scan_convert_{self.columns}x{self.glyph_width}{suffix}"
+
+    @property
+    def double_width(self):
+        """The kernel for this one's double-width rows"""
+        return Kernel(self.columns // 2, self.glyph_width, self.fifo_words, True)
+
+    @property
+    def scale(self):
+        return 2 if self.wide else 1
+
+    @property
+    def glyph_shift(self):
+        # mkfont.py leaves the doubled glyph bits 2 places up, so that they
+        # line up with the 30 bits the pixel state machine shifts out of each
+        # 32-bit word; wider glyphs don't have room for that in 16 bits.
+        # Widening a glyph doubles its shift along with its bits.
+        return min(2, 16 - 2 * self.glyph_width) * self.scale
+
+    @property
+    def glyph_mask(self):
+        return ((1 << 2 * self.glyph_width) - 1) << min(2, 16 - 2 * self.glyph_width)
+
+    @property
+    def pixels(self):
+        return self.glyph_width * self.scale
+
+    @property
+    def margin(self):
+        return (LINE_PIXELS - self.columns * self.pixels) // 2
+
+    @property
+    def words(self):
+        return LINE_PIXELS // PIXELS_PER_WORD
+
+    def check(self):
+        def fail(msg):
+            raise SystemExit(f"{self.name}: {msg}")
+
+        if self.glyph_shift < 0:
+            fail("glyphs wider than 8 pixels don't fit in 16 bits")
+        if self.columns % 2:
+            fail("columns must be even (cells are read in pairs)")
+        if self.columns * self.pixels > LINE_PIXELS:
+            fail(f"{self.columns * self.pixels} pixels exceed {LINE_PIXELS}")
+        if self.fifo_words > FIFO_DEPTH - FIFO_LOW_WATER:
+            fail(f"{self.fifo_words} words between FIFO waits overflow the FIFO")
+
+
+class Emitter:
+    def __init__(self, kernel, file):
+        self.kernel = kernel
+        self.file = file
+        self.cycles = 0
+        self.words = 0
+        self.chars = 0
+        self.interval_cycles = 0
+        self.worst_interval_cycles = 0
+
+    def emit(self, line, cost=0, comment=None):
+        comment = f" /* {comment} */" if comment else ""
+        print(f"    {line};{comment}", file=self.file)
+        self.cycles += cost
+        self.interval_cycles += cost
+
+    def write_word(self, stmt=None):
+        if stmt:
+            self.emit(stmt)
+        self.emit("WRITE_PIXDATA", CYCLES["WRITE_PIXDATA"])
+        self.word_written()
+
+    def word_written(self):
+        self.words += 1
+        k = self.kernel
+        if self.words % k.fifo_words == 0 and self.words < k.words:
+            self.emit("FIFO_WAIT", CYCLES["FIFO_POLL"], f"{self.chars:3d}")
+            print(file=self.file)
+            self.worst_interval_cycles = max(
+                self.worst_interval_cycles, self.interval_cycles
+            )
+            self.interval_cycles = 0
+
+
+def print_kernel(k, file=sys.stdout):
+    k.check()
+    bits = 2 * k.pixels
+    wide = "WIDE_" if k.wide else ""
+    char_cycles = CYCLES["ONE_CHAR"] + CYCLES["ATTR_LOOKUP"]
+    if k.wide:
+        char_cycles += CYCLES["WIDEN"]
+
+    body = io.StringIO()
+    e = Emitter(k, body)
+    splits = False
+    e.emit("SCANLINE_SETUP")
+    margin = 2 * k.margin
+    while margin >= 30:
+        e.write_word("pixels = 0")
+        margin -= 30
+    pos = margin  # bit position in the current word, from the top
+    for i in range(k.columns):
+        if i % 2 == 0:
+            e.emit("READ_CHARDATA", CYCLES["READ_CHARDATA"])
+        in_shift = 16 * (i % 2)
+        # the left margin is whatever the first glyph doesn't overwrite
+        op = "=" if pos == 0 or i == 0 else "|="
+        shift = 32 - pos - bits - k.glyph_shift
+        if pos + bits <= 30:
+            out = f"<< {shift}" if shift > 0 else f">> {-shift}" if shift else ""
+            e.emit(f"ONE_{wide}CHAR({in_shift}, {op}, {out})", char_cycles)
+            e.chars += 1
+            pos += bits
+        else:
+            # the glyph straddles two words; SPLIT_CHAR writes the first
+            e.emit(
+                f"SPLIT_{wide}CHAR({in_shift}, {op}, {-shift}, {30 + shift})",
+                char_cycles + CYCLES["SPLIT_CHAR"] + CYCLES["WRITE_PIXDATA"],
+            )
+            e.chars += 1
+            e.word_written()
+            splits = True
+            pos += bits - 30
+        # a 32-bit wide glyph can also finish the word it continues
+        if pos == 30:
+            e.write_word()
+            pos = 0
+    if pos:
+        e.write_word()
+    while e.words < k.words:
+        e.write_word("pixels = 0")
+
+    glyph_decl = "\n    uint16_t glyph;" if splits or k.wide else ""
+    if k.wide:
+        glyph_decl += "\n    uint32_t wide;"
+    proto = f"void {k.name}("
+    defn = f"void __not_in_flash_func({k.name})("
+    pad, dpad = " " * len(proto), " " * len(defn)
+    print(
+        f"""
+// {k.columns} columns of {k.pixels}-pixel glyphs, FIFO_WAIT every {k.fifo_words} words
+{proto}const uint32_t *restrict cptr32,
+{pad}const uint16_t *restrict cgptr,
+{pad}const uint32_t *restrict attrs, uint32_t *restrict out);
+{defn}const uint32_t *restrict cptr32,
+{dpad}const uint16_t *restrict cgptr,
+{dpad}const uint32_t *restrict attrs,
+{dpad}uint32_t *restrict out) {{
+    uint32_t ch;
+    uint16_t chardata;{glyph_decl}
+    uint32_t attr;
+    uint32_t pixels;
+""",
+        file=file,
+    )
+    print(body.getvalue().rstrip(), file=file)
+    print("}", file=file)
+    # In the direct-to-FIFO mode every interval must be produced no slower
+    # than the pixel state machine drains it, or the FIFO underruns.
+    drain = k.fifo_words * PIXELS_PER_WORD * CYCLES_PER_PIXEL
+    if e.worst_interval_cycles > drain:
+        raise SystemExit(
+            f"{k.name}: ~{e.worst_interval_cycles} cycles between FIFO waits, "
+            f"but the FIFO drains in {drain}"
+        )
+    line = k.words * PIXELS_PER_WORD * CYCLES_PER_PIXEL
+    if e.cycles > line:
+        raise SystemExit(
+            f"{k.name}: ~{e.cycles} cycles per scanline, but a line is {line}"
+        )
+    print(
+        f"// {k.name}: ~{e.cycles}/{line} cycles per scanline, "
+        f"~{e.worst_interval_cycles}/{drain} between FIFO waits",
+        file=file,
+    )
+
+
+def print_all(kernels, file=sys.stdout):
+    print("// Generated by mkscan.py, do not edit", file=file)
+    print("#pragma once", file=file)
+    for name, cycles in CYCLES.items():
+        print(
+            f"""
+#ifndef CYCLES_{name}
+#define CYCLES_{name} ({cycles})
+#endif""",
+            file=file,
+        )
+    for k in kernels:
+        print_kernel(k, file=file)
+        print_kernel(k.double_width, file=file)
+
+    print(
+        f"""
+// The kernels by screen geometry; index them with SCAN_<columns>x<glyph width>
+// note: not in flash (referenced from core1 generator thread)
+static scan_geometry_t scan_geometries[] = {{""",
+        file=file,
+    )
+    for k in kernels:
+        print(
+            f"    {{{k.name}, {k.double_width.name}, {k.columns}, "
+            f"{k.glyph_width}, {k.margin}, 0x{k.glyph_mask:04x}}},",
+            file=file,
+        )
+    print("};", file=file)
+    print(f"#define SCAN_GEOMETRIES ({len(kernels)})", file=file)
+    for i, k in enumerate(kernels):
+        print(f"#define SCAN_{k.columns}x{k.glyph_width} ({i})", file=file)
+
+
+kernels = [
+    Kernel(columns=132, glyph_width=5, fifo_words=6),
+    Kernel(columns=80, glyph_width=8, fifo_words=6),
+]
+
+if __name__ == "__main__":
+    with open(sys.argv[1], "wt", encoding="utf-8") as f:
+        print_all(kernels, file=f)
@@ -0,0 +1,340 @@
+#pragma once
+
+// The scanline kernel, shared between the firmware (chargen.c) and the
+// host-side benchmark (scanbench.c). Include it from exactly one translation
+// unit.
+//
+// With RENDER_DMA (the default), each scanline is rendered into a buffer that
+// a DMA channel paced by the pixel state machine's DREQ copies to its FIFO.
+// Otherwise the kernel writes the FIFO directly, waiting for it to drain every
+// 6 words.
+//
+// Each cell's 7 attribute bits select a (mask, xor) pair from one of the
+// attr_tables, which fold in the blink phase and the visual bell. Underline and
+// strike-through are attribute bits that only the tables used on their glyph
+// line draw, as a solid line in the cell's foreground color, so the kernel
+// never tests for them. With ROW_DECODE, a text row's attributes are resolved
+// once by scan_decode_row, and the kernel reads the result in order on each of
+// the row's 9 scanlines; a row that has underlined or struck-through cells is
+// decoded again for the scanlines that draw them.
+//
+// With RENDER_INTERP (the default), core1's interpolator 0 turns each pair of
+// cells into the addresses of their glyph rows, replacing the shifts and masks
+// of the table lookup.
+//
+// The kernels themselves are fully unrolled for each screen geometry (132
+// columns of 5-pixel glyphs, and 80 of 8) and are generated by mkscan.py into
+// scan_kernels.h from the step macros below. Each geometry has a second kernel
+// for double-width and double-height rows, which draws half as many glyphs
+// with their pixels doubled through widen_pixels; the renderer picks the
+// glyph rows of either half of a double-height row.
+//
+// When STANDALONE is set, the PIO FIFO accesses are replaced by calls into a
+// model of the pixel state machine's TX FIFO, and every step of the kernel
+// charges its cost (in core1 cycles) to bench_cycles. In the firmware the
+// BENCH_CYCLES annotations compile to nothing.
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// FB_WIDTH_CHAR and CHAR_X are those of the widest geometry, see
+// scan_geometries, and FB_HEIGHT_CHAR is the rows of the tallest video mode
+// (vgamode.py)
+#define FB_WIDTH_CHAR (132)
+#define FB_HEIGHT_CHAR (53)
+#define CHAR_X (5)
+#define CHAR_Y (9)
+#define FB_WIDTH_PIXEL (660)
+#define FB_HEIGHT_PIXEL (FB_HEIGHT_CHAR * CHAR_Y)
+
+#define CHAR_COUNT (512)
+
+#define ATTR_BASE 9
+
+// 15 pixels (30 bits) per FIFO word
+#define PIXELS_PER_WORD (15)
+#define FB_WORDS_PER_LINE (FB_WIDTH_PIXEL / PIXELS_PER_WORD)
+
+#ifndef RENDER_DMA
+#define RENDER_DMA (1)
+#endif
+
+// Keep every rendered scanline and re-render only the text rows that changed.
+// The cached scanlines are sent by DMA, so this needs RENDER_DMA.
+#ifndef ROW_CACHE
+#define ROW_CACHE (RENDER_DMA)
+#endif
+#if ROW_CACHE && !RENDER_DMA
+#error "ROW_CACHE requires RENDER_DMA"
+#endif
+
+#ifndef RENDER_INTERP
+#define RENDER_INTERP (1)
+#endif
+
+// Decoding a row delays its first scanline, which only a DMA buffer has the
+// slack to absorb.
+#ifndef ROW_DECODE
+#define ROW_DECODE (RENDER_DMA)
+#endif
+#if ROW_DECODE && !RENDER_DMA
+#error "ROW_DECODE requires RENDER_DMA"
+#endif
+
+#if STANDALONE
+#define __not_in_flash_func(x) x
+
+// The per-step cycle costs (CYCLES_*) come from scan_kernels.h. Override them
+// with -D to calibrate against a disassembly.
+
+extern uint32_t bench_cycles;
+extern uint32_t bench_extra_cycles_per_char;
+void bench_write_pixdata(uint32_t pixels);
+void bench_fifo_wait(void);
+void bench_interp_accum(uint32_t value);
+void bench_interp_base(int lane, const void *base);
+const void *bench_interp_peek(int lane);
+
+#define BENCH_CYCLES(n) (bench_cycles += (n))
+#if RENDER_DMA
+#define WRITE_PIXDATA                                                          \
+    (BENCH_CYCLES(CYCLES_WRITE_PIXDATA), *out++ = pixels)
+#define FIFO_WAIT ((void)0)
+#else
+#define WRITE_PIXDATA                                                          \
+    (BENCH_CYCLES(CYCLES_WRITE_PIXDATA), bench_write_pixdata(pixels))
+#define FIFO_WAIT bench_fifo_wait()
+#endif
+#define INTERP_ACCUM(value) bench_interp_accum(value)
+#define INTERP_BASE(lane, addr) bench_interp_base((lane), (addr))
+#define INTERP_PEEK(lane) bench_interp_peek(lane)
+#else
+#define BENCH_CYCLES(n) ((void)0)
+#if RENDER_DMA
+#define WRITE_PIXDATA (*out++ = pixels)
+#define FIFO_WAIT ((void)0)
+#else
+#define WRITE_PIXDATA (pio0->txf[0] = pixels)
+#define FIFO_WAIT                                                              \
+    do { /* NOTHING */                                                         \
+    } while (pio_sm_get_tx_fifo_level(pio0, 0) > 2)
+#endif
+#define INTERP_ACCUM(value) (interp0->accum[0] = (value))
+#define INTERP_BASE(lane, addr) (interp0->base[lane] = (uintptr_t)(addr))
+#define INTERP_PEEK(lane) ((const void *)(uintptr_t)interp0->peek[lane])
+#endif
+
+// The low 3 attribute bits index the mask (fg) shade, the next 2 the xor (bg)
+// shade. Blink-off uses the entries 4 further on, the visual bell 12. The
+// shades are trimmed to a geometry's glyph bits when the tables are built.
+// note: not in flash (referenced from core1 generator thread)
+static uint16_t base_shade[] = {
+    0,      0x5555, 0xaaaa, 0xffff, 0,      0x5555, 0xaaaa, 0xffff,
+    0,      0,      0,      0,      0xffff, 0xaaaa, 0x5555, 0x0000,
+    0xffff, 0xaaaa, 0x5555, 0x0000, 0xffff, 0xffff, 0xffff, 0xffff};
+
+#define ATTR_COUNT (128)
+#define ATTR_STRIKE (1 << 5)
+#define ATTR_UNDERLINE (1 << 6)
+
+// The glyph lines that ATTR_STRIKE and ATTR_UNDERLINE draw over
+#define STRIKE_GLYPH_LINE (4)
+#define UNDERLINE_GLYPH_LINE (CHAR_Y - 1)
+
+// The attribute table phases: blink, visual bell, and the glyph lines that draw
+// ATTR_STRIKE or ATTR_UNDERLINE (never both), whose phase bits are those
+// attribute bits shifted down by 3
+#define ATTR_BLINK_OFF (1)
+#define ATTR_BELL (2)
+#define ATTR_STRIKE_LINE (ATTR_STRIKE >> 3)
+#define ATTR_UNDERLINE_LINE (ATTR_UNDERLINE >> 3)
+#define ATTR_PHASES (12)
+
+// note: not in flash (referenced from core1 generator thread)
+// One table of (xor << 16 | mask) per attribute for each phase, filled in by
+// scan_attr_tables
+static uint32_t attr_tables[ATTR_PHASES][ATTR_COUNT];
+
+// The interpolator's lanes give the glyph row addresses of the low and high
+// cell of a pair. The accumulator holds the cells shifted up by 1, so each
+// masked glyph index is already a halfword offset from the lane's base.
+typedef struct {
+    uint8_t shift, mask_lsb, mask_msb;
+    bool cross_input;
+} interp_lane_t;
+static const interp_lane_t interp_lanes[2] = {
+    {0, 1, ATTR_BASE, false},
+    {16, 1, ATTR_BASE, true},
+};
+
+#if ROW_DECODE
+#define LOOKUP_ATTR(in_shift) (attr = *attrs++)
+#else
+#define LOOKUP_ATTR(in_shift)                                                  \
+    (BENCH_CYCLES(CYCLES_ATTR_LOOKUP),                                         \
+     attr = attrs[(ch >> (ATTR_BASE + (in_shift))) & (ATTR_COUNT - 1)])
+#endif
+
+#if RENDER_INTERP
+#define SCANLINE_SETUP                                                         \
+    (BENCH_CYCLES(CYCLES_INTERP_SETUP), INTERP_BASE(0, cgptr),                 \
+     INTERP_BASE(1, cgptr))
+#define READ_CHARDATA                                                          \
+    (BENCH_CYCLES(CYCLES_INTERP_READ_CHARDATA), ch = *cptr32++,                \
+     INTERP_ACCUM(ch << 1))
+#define LOOKUP_CHAR(in_shift)                                                  \
+    (BENCH_CYCLES(CYCLES_INTERP_ONE_CHAR),                                     \
+     chardata = *(const uint16_t *)INTERP_PEEK((in_shift) / 16),               \
+     LOOKUP_ATTR(in_shift))
+#else
+#define SCANLINE_SETUP ((void)0)
+#define READ_CHARDATA (BENCH_CYCLES(CYCLES_READ_CHARDATA), ch = *cptr32++)
+#define LOOKUP_CHAR(in_shift)                                                  \
+    (BENCH_CYCLES(CYCLES_ONE_CHAR),                                            \
+     chardata = cgptr[(ch >> (in_shift)) & ((1 << ATTR_BASE) - 1)],            \
+     LOOKUP_ATTR(in_shift))
+#endif
+
+#define ONE_CHAR(in_shift, op, out_shift)                                      \
+    do {                                                                       \
+        BENCH_CYCLES(bench_extra_cycles_per_char);                             \
+        LOOKUP_CHAR(in_shift);                                                 \
+        pixels op((attr >> 16) ^ (chardata & attr)) out_shift;                 \
+    } while (0)
+// A glyph that straddles two FIFO words: finish and write the current word
+// with its leading pixels, then start the next one with the rest
+#define SPLIT_CHAR(in_shift, op, hi_shift, lo_shift)                           \
+    do {                                                                       \
+        BENCH_CYCLES(CYCLES_SPLIT_CHAR + bench_extra_cycles_per_char);         \
+        LOOKUP_CHAR(in_shift);                                                 \
+        glyph = (attr >> 16) ^ (chardata & attr);                              \
+        pixels op glyph >> (hi_shift);                                         \
+        WRITE_PIXDATA;                                                         \
+        pixels = (uint32_t)glyph << (lo_shift);                                \
+    } while (0)
+
+// note: not in flash (referenced from core1 generator thread)
+// Each 2-bit pixel of a byte of glyph data, twice, filled in by
+// scan_convert_init
+static uint16_t widen_pixels[256];
+
+#define WIDEN_GLYPH                                                            \
+    (BENCH_CYCLES(CYCLES_WIDEN), glyph = (attr >> 16) ^ (chardata & attr),     \
+     wide = widen_pixels[glyph & 0xff] |                                       \
+            (uint32_t)widen_pixels[glyph >> 8] << 16)
+#define ONE_WIDE_CHAR(in_shift, op, out_shift)                                 \
+    do {                                                                       \
+        BENCH_CYCLES(bench_extra_cycles_per_char);                             \
+        LOOKUP_CHAR(in_shift);                                                 \
+        WIDEN_GLYPH;                                                           \
+        pixels op wide out_shift;                                              \
+    } while (0)
+#define SPLIT_WIDE_CHAR(in_shift, op, hi_shift, lo_shift)                      \
+    do {                                                                       \
+        BENCH_CYCLES(CYCLES_SPLIT_CHAR + bench_extra_cycles_per_char);         \
+        LOOKUP_CHAR(in_shift);                                                 \
+        WIDEN_GLYPH;                                                           \
+        pixels op wide >> (hi_shift);                                          \
+        WRITE_PIXDATA;                                                         \
+        pixels = wide << (lo_shift);                                           \
+    } while (0)
+
+// declaring the kernels static breaks them (why?)
+// `attrs` holds the row's attributes from scan_decode_row with ROW_DECODE, and
+// is the live attribute table otherwise. `out` receives FB_WORDS_PER_LINE
+// words with RENDER_DMA and is unused otherwise.
+typedef void scan_kernel_t(const uint32_t *restrict cptr32,
+                           const uint16_t *restrict cgptr,
+                           const uint32_t *restrict attrs,
+                           uint32_t *restrict out);
+
+// A screen geometry: its kernels for normal and double-width rows, how many
+// cells of what width it draws (half as many, twice as wide, on double-width
+// rows), the black margin left of them in pixels, and the bits of a font entry
+// its glyphs occupy
+typedef struct {
+    scan_kernel_t *convert, *convert_double;
+    int columns, glyph_width, margin;
+    uint16_t glyph_mask;
+} scan_geometry_t;
+
+#include "scan_kernels.h"
+
+// The geometry that draws `columns` cells, or the first one
+static inline const scan_geometry_t *
+__not_in_flash_func(scan_find_geometry)(int columns) {
+    for (int g = 0; g < SCAN_GEOMETRIES; g++) {
+        if (scan_geometries[g].columns == columns) {
+            return &scan_geometries[g];
+        }
+    }
+    return &scan_geometries[0];
+}
+
+// The attribute bit drawn as a line on glyph line `line`, if any
+static inline int __not_in_flash_func(scan_line_attr)(int line) {
+    return line == UNDERLINE_GLYPH_LINE ? ATTR_UNDERLINE
+           : line == STRIKE_GLYPH_LINE  ? ATTR_STRIKE
+                                        : 0;
+}
+
+#if ROW_DECODE
+// Resolve the attributes of the first `columns` cells of a text row to their
+// entries in `table`, once for all of the row's scanlines. Returns every
+// attribute bit set in any of the cells.
+static uint32_t __not_in_flash_func(scan_decode_row)(
+    const uint32_t *restrict cptr32, const uint32_t *restrict table,
+    uint32_t *restrict attrs, int columns) {
+    uint32_t used = 0;
+    for (int i = 0; i < columns / 2; i++) {
+        BENCH_CYCLES(CYCLES_DECODE_PAIR);
+        uint32_t ch = *cptr32++;
+        used |= ch;
+        *attrs++ = table[(ch >> ATTR_BASE) & (ATTR_COUNT - 1)];
+        *attrs++ = table[(ch >> (ATTR_BASE + 16)) & (ATTR_COUNT - 1)];
+    }
+    return ((used | used >> 16) >> ATTR_BASE) & (ATTR_COUNT - 1);
+}
+#endif
+
+// Fill in the attribute tables for a geometry's glyphs
+static void __not_in_flash_func(scan_attr_tables)(const scan_geometry_t *geom) {
+    for (int phase = 0; phase < ATTR_PHASES; phase++) {
+        const uint16_t *shade = base_shade + (phase & ATTR_BLINK_OFF ? 4 : 0) +
+                                (phase & ATTR_BELL ? 12 : 0);
+        int line_attr = (phase << 3) & (ATTR_STRIKE | ATTR_UNDERLINE);
+        for (int attr = 0; attr < ATTR_COUNT; attr++) {
+            uint16_t xor = shade[(attr >> 3) & 3] & geom->glyph_mask;
+            uint16_t mask = shade[attr & 7] & geom->glyph_mask;
+            // a line is every glyph pixel in the foreground color
+            if (attr & line_attr) {
+                xor ^= mask;
+                mask = 0;
+            }
+            attr_tables[phase][attr] = (uint32_t)xor << 16 | mask;
+        }
+    }
+}
+
+// Fill in the attribute tables for the first geometry and the pixel doubling
+// table, and configure the calling core's interpolator for the kernels
+static void scan_convert_init(void) {
+    scan_attr_tables(&scan_geometries[0]);
+    for (int byte = 0; byte < 256; byte++) {
+        uint16_t wide = 0;
+        for (int p = 0; p < 4; p++) {
+            wide |= ((byte >> (2 * p)) & 3) * 5 << (4 * p);
+        }
+        widen_pixels[byte] = wide;
+    }
+#if RENDER_INTERP && !STANDALONE
+    for (int lane = 0; lane < 2; lane++) {
+        const interp_lane_t *l = &interp_lanes[lane];
+        interp_config cfg = interp_default_config();
+        interp_config_set_shift(&cfg, l->shift);
+        interp_config_set_mask(&cfg, l->mask_lsb, l->mask_msb);
+        interp_config_set_cross_input(&cfg, l->cross_input);
+        interp_set_config(interp0, lane, &cfg);
+    }
+#endif
+}
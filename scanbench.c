@@ -0,0 +1,354 @@
+// Host-side benchmark for the scanline kernel in scan_convert.h.
+//
+// Runs the real kernel over whole frames of test patterns. The pixel state
+// machine's joined TX FIFO is modeled at the VGA drain rate (one 30-bit word
+// every 15 pixels), while core1's time is tracked through the per-step cycle
+// costs in scan_convert.h. With RENDER_DMA the DMA channel is modeled as
+// moving each finished scanline into the FIFO as space frees up, and with
+// RENDER_INTERP the interpolators are modeled in software. Reports the busy
+// cycles per scanline, the minimum FIFO level seen when the state machine
+// pulls a word, any underruns or overflows, and how many extra cycles per
+// character the kernel could spend before it underruns, for each of the
+// screen geometries.
+//
+// Build and run with `make bench`. The exit status is nonzero if any pattern
+// underruns or overflows the FIFO.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define STANDALONE (1)
+#include "scan_convert.h"
+
+static uint16_t chargen[CHAR_COUNT * CHAR_Y] = {
+#include "5x9.h"
+};
+static uint16_t chargen_80[CHAR_COUNT * CHAR_Y] = {
+#include "8x9.h"
+};
+static const uint16_t *const fonts[SCAN_GEOMETRIES] = {
+    [SCAN_132x5] = chargen,
+    [SCAN_80x8] = chargen_80,
+};
+
+// 660x477@60 timing from vgamode.py at 6 system clocks per pixel
+#define CYCLES_PER_PIXEL (6)
+#define LINE_PIXELS (826)
+#define FRAME_LINES (525)
+#define CYCLES_PER_WORD (CYCLES_PER_PIXEL * PIXELS_PER_WORD)
+#define CYCLES_PER_LINE (CYCLES_PER_PIXEL * LINE_PIXELS)
+#define WORDS_PER_FRAME (FB_WORDS_PER_LINE * FB_HEIGHT_PIXEL)
+#define FIFO_DEPTH (8)
+
+// core1_loop overhead per scan_convert call (call, prologue, epilogue, loop)
+// and per text row (the lw_terminal_vt100_getline call)
+#define CYCLES_CALL (24)
+#define CYCLES_ROW (30)
+// restarting the DMA channel for a scanline
+#define CYCLES_DMA_START (12)
+
+#define N_FRAMES (3)
+
+uint32_t bench_cycles;
+uint32_t bench_extra_cycles_per_char;
+
+static struct {
+    uint64_t frame_start;
+    uint32_t next_word;
+    int level, min_level;
+    uint32_t underruns, overflows;
+    bool stalled;
+    uint64_t wait_cycles;
+    uint32_t checksum;
+} fifo;
+
+// bench_cycles is 32 bits to keep the kernel's bookkeeping cheap; extend it
+// here so multi-frame runs don't wrap
+static uint64_t now_hi, last_now;
+static uint64_t now(void) {
+    if (bench_cycles < (uint32_t)last_now) {
+        now_hi += 1ull << 32;
+    }
+    last_now = now_hi | bench_cycles;
+    return last_now;
+}
+
+static uint64_t pull_time(uint32_t word) {
+    return fifo.frame_start + (word / FB_WORDS_PER_LINE) * CYCLES_PER_LINE +
+           (word % FB_WORDS_PER_LINE) * CYCLES_PER_WORD;
+}
+
+// Let the pixel state machine take every word it would have pulled by now.
+// When it finds the FIFO empty it stalls until the next word arrives.
+static void drain(void) {
+    uint64_t t = now();
+    while (pull_time(fifo.next_word) <= t) {
+        if (fifo.level == 0) {
+            if (!fifo.stalled) {
+                fifo.underruns++;
+                fifo.stalled = true;
+            }
+            return;
+        }
+        fifo.stalled = false;
+        if (fifo.level < fifo.min_level) {
+            fifo.min_level = fifo.level;
+        }
+        fifo.level--;
+        if (++fifo.next_word == WORDS_PER_FRAME) {
+            fifo.next_word = 0;
+            fifo.frame_start += (uint64_t)FRAME_LINES * CYCLES_PER_LINE;
+        }
+    }
+}
+
+void bench_write_pixdata(uint32_t pixels) {
+    drain();
+    if (fifo.level == FIFO_DEPTH) {
+        fifo.overflows++;
+    } else {
+        fifo.level++;
+    }
+    fifo.checksum = (fifo.checksum ^ pixels) * 16777619u;
+}
+
+void bench_fifo_wait(void) {
+    drain();
+    while (fifo.level > 2) {
+        bench_cycles += CYCLES_FIFO_POLL;
+        fifo.wait_cycles += CYCLES_FIFO_POLL;
+        drain();
+    }
+}
+
+// The interpolator, as configured by interp_lanes
+static struct {
+    uint32_t accum[2];
+    const void *base[2];
+} interp;
+
+void bench_interp_accum(uint32_t value) { interp.accum[0] = value; }
+
+void bench_interp_base(int lane, const void *base) { interp.base[lane] = base; }
+
+const void *bench_interp_peek(int lane) {
+    const interp_lane_t *l = &interp_lanes[lane];
+    uint32_t mask = (2u << l->mask_msb) - (1u << l->mask_lsb);
+    uint32_t offset =
+        (interp.accum[l->cross_input ? !lane : lane] >> l->shift) & mask;
+    return (const char *)interp.base[lane] + offset;
+}
+
+#if RENDER_DMA
+// Wait for the DMA channel to hand the previous scanline to the FIFO, then
+// start it on this one. Words the channel still holds count towards
+// fifo.level, so the FIFO itself is full whenever the level exceeds its depth.
+static void send_scanline(const uint32_t *buf) {
+    drain();
+    while (fifo.level > FIFO_DEPTH) {
+        bench_cycles += CYCLES_FIFO_POLL;
+        fifo.wait_cycles += CYCLES_FIFO_POLL;
+        drain();
+    }
+    bench_cycles += CYCLES_DMA_START;
+    for (int i = 0; i < FB_WORDS_PER_LINE; i++) {
+        fifo.checksum = (fifo.checksum ^ buf[i]) * 16777619u;
+    }
+    fifo.level += FB_WORDS_PER_LINE;
+}
+#else
+#define send_scanline(buf) ((void)0)
+#endif
+
+#if ROW_CACHE
+static uint32_t row_cache[FB_HEIGHT_CHAR][CHAR_Y][FB_WORDS_PER_LINE];
+#define SCANLINE_BUF(row, j) (row_cache[row][j])
+#elif RENDER_DMA
+static uint32_t scanline_buf[2][FB_WORDS_PER_LINE];
+static int scanline_idx;
+#define SCANLINE_BUF(row, j) (scanline_buf[scanline_idx ^= 1])
+#else
+#define SCANLINE_BUF(row, j) (NULL)
+#endif
+
+typedef struct {
+    const char *name;
+    uint16_t (*cell)(int x, int y);
+} pattern_t;
+
+static uint16_t cell_blank(int x, int y) { return ' '; }
+static uint16_t cell_text(int x, int y) {
+    return (' ' + (x + y) % 95) | (3 << ATTR_BASE);
+}
+static uint16_t cell_random(int x, int y) {
+    uint32_t h = (x * 131 + y) * 2654435761u;
+    return h >> 16;
+}
+static uint16_t cell_worst(int x, int y) { return 0xffff; }
+
+static const pattern_t patterns[] = {
+    {"blank", cell_blank},
+    {"text", cell_text},
+    {"random", cell_random},
+    {"worst", cell_worst},
+};
+#define N_PATTERNS (sizeof(patterns) / sizeof(patterns[0]))
+
+static uint32_t screen[FB_HEIGHT_CHAR][FB_WIDTH_CHAR / 2];
+#if ROW_DECODE
+static uint32_t row_attrs[FB_WIDTH_CHAR];
+static uint32_t line_attrs[FB_WIDTH_CHAR];
+#endif
+
+typedef struct {
+    uint64_t busy, busy_max;
+} result_t;
+
+// With `cached`, every row is clean after the first frame, as on a screen
+// that isn't changing; otherwise every row is rendered every frame. With
+// `wide`, every row is double width (DECDWL).
+static result_t run(const scan_geometry_t *geom, const pattern_t *p,
+                    uint32_t extra, bool cached, bool wide) {
+    const uint16_t *font = fonts[geom - scan_geometries];
+    scan_kernel_t *convert = wide ? geom->convert_double : geom->convert;
+    result_t r = {0, 0};
+    for (int y = 0; y < FB_HEIGHT_CHAR; y++) {
+        uint16_t *row = (uint16_t *)screen[y];
+        for (int x = 0; x < FB_WIDTH_CHAR; x++) {
+            row[x] = p->cell(x, y);
+        }
+    }
+
+    bench_cycles = 0;
+    now_hi = last_now = 0;
+    bench_extra_cycles_per_char = extra;
+    fifo.frame_start = (uint64_t)(FRAME_LINES - FB_HEIGHT_PIXEL) *
+                       CYCLES_PER_LINE;
+    fifo.next_word = 0;
+    fifo.level = 0;
+    fifo.min_level = FIFO_DEPTH;
+    fifo.underruns = fifo.overflows = 0;
+    fifo.stalled = false;
+    fifo.wait_cycles = 0;
+    fifo.checksum = 2166136261u;
+
+    for (int frame = 0; frame < N_FRAMES; frame++) {
+        for (int row = 0; row < FB_HEIGHT_CHAR; row++) {
+            bool clean = ROW_CACHE && cached && frame > 0;
+            bench_cycles += CYCLES_ROW;
+            uint64_t decode = now();
+#if ROW_DECODE
+            int cells = wide ? geom->columns / 2 : geom->columns;
+            uint32_t row_used = 0;
+            if (!clean) {
+                row_used = scan_decode_row(
+                    screen[row], attr_tables[ATTR_BLINK_OFF], row_attrs, cells);
+            }
+#endif
+            decode = now() - decode;
+            for (int j = 0; j < CHAR_Y; j++) {
+                bench_cycles += CYCLES_CALL;
+                uint64_t t0 = now(), w0 = fifo.wait_cycles;
+                uint32_t *buf = SCANLINE_BUF(row, j);
+                const uint32_t *line_table =
+                    attr_tables[ATTR_BLINK_OFF | scan_line_attr(j) >> 3];
+#if ROW_DECODE
+                // as the renderer does on the lines of underlined or
+                // struck-through rows
+                const uint32_t *cell_attrs = row_attrs;
+                if (row_used & scan_line_attr(j)) {
+                    scan_decode_row(screen[row], line_table, line_attrs,
+                                    cells);
+                    cell_attrs = line_attrs;
+                }
+#else
+                const uint32_t *cell_attrs = line_table;
+#endif
+                if (!clean) {
+                    convert(screen[row], &font[CHAR_COUNT * j], cell_attrs,
+                            buf);
+                }
+                send_scanline(buf);
+                uint64_t busy = (now() - t0) - (fifo.wait_cycles - w0) +
+                                CYCLES_CALL;
+                if (j == 0) {
+                    busy += CYCLES_ROW + decode;
+                }
+                r.busy += busy;
+                if (busy > r.busy_max) {
+                    r.busy_max = busy;
+                }
+            }
+        }
+    }
+    return r;
+}
+
+static void report(const char *name, result_t r) {
+    uint32_t lines = N_FRAMES * FB_HEIGHT_PIXEL;
+    printf("%-8s %10.1f %10llu %10.1f %8d %9u %9u %08x\n", name,
+           (double)r.busy / lines, (unsigned long long)r.busy_max,
+           (double)fifo.wait_cycles / lines, fifo.min_level, fifo.underruns,
+           fifo.overflows, fifo.checksum);
+}
+
+int main(void) {
+    int status = EXIT_SUCCESS;
+
+    scan_convert_init();
+
+    for (int g = 0; g < SCAN_GEOMETRIES; g++) {
+        const scan_geometry_t *geom = &scan_geometries[g];
+        int char_cycles = CYCLES_PER_PIXEL * geom->glyph_width;
+        scan_attr_tables(geom);
+
+        printf("%sscan_convert (%s, %s): %dx%d cells, %d words/scanline\n",
+               g ? "\n" : "", RENDER_DMA ? "dma" : "fifo",
+               RENDER_INTERP ? "interp" : "table", geom->columns,
+               FB_HEIGHT_CHAR, FB_WORDS_PER_LINE);
+        printf("budget: %d cycles/scanline, %d during active video, %d per "
+               "character\n",
+               CYCLES_PER_LINE, FB_WORDS_PER_LINE * CYCLES_PER_WORD,
+               char_cycles);
+        printf("%-8s %10s %10s %10s %8s %9s %9s %10s\n", "pattern",
+               "cyc/line", "max", "wait/line", "minfifo", "underrun",
+               "overflow", "checksum");
+
+        for (size_t i = 0; i < N_PATTERNS; i++) {
+            report(patterns[i].name,
+                   run(geom, &patterns[i], 0, false, false));
+            if (fifo.underruns || fifo.overflows) {
+                status = EXIT_FAILURE;
+            }
+        }
+#if ROW_CACHE
+        // the same text, unchanged after the first frame
+        report("cached", run(geom, &patterns[1], 0, true, false));
+#endif
+        // the same text in double-width rows
+        report("wide", run(geom, &patterns[1], 0, false, true));
+        if (fifo.underruns || fifo.overflows) {
+            status = EXIT_FAILURE;
+        }
+
+        // The kernel has no data-dependent branches, so the worst pattern
+        // stands in for every glyph/attribute mix when searching for the
+        // margin.
+        const pattern_t *worst = &patterns[N_PATTERNS - 1];
+        uint32_t extra = 0;
+        while (extra < char_cycles) {
+            run(geom, worst, extra + 1, false, false);
+            if (fifo.underruns || fifo.overflows) {
+                break;
+            }
+            extra++;
+        }
+        printf("headroom: %u cycles/character before underrun\n", extra);
+    }
+    if (status != EXIT_SUCCESS) {
+        printf("FAIL: pixel FIFO underrun or overflow\n");
+    }
+
+    return status;
+}
@@ -191,6 +191,12 @@ static inline void {program_name_base}_hsync_program_init(PIO pio, uint sm, uint
     )
 
 
+# PIO IRQ flag raised by the vsync program when vertical blanking starts, the
+# same in every mode (VIDEO_VBLANK_IRQ in vga_modes.h). Flags 0 and 1 pace the
+# vsync and pixel programs.
+VBLANK_IRQ = 2
+
+
 def pio_yloop(instr, n, label, comment, file):
     assert n <= 65
     if n < 3:
@@ -223,6 +229,7 @@ def print_pio_vsync_program(program_name_base, mode, cycles_per_pixel, file=sys.
 ; Vertical sync program for {mode}
 ;
 .wrap_target                      ; Program wraps to here
+    irq {VBLANK_IRQ}                         ; Signal vertical blanking to the CPU
 """,
         file=file,
     )
@@ -391,18 +398,78 @@ if 0:
     print(mode_vga_660x400, 6 * mode_vga_660x400.pixel_clock_khz)
 
 
+def program_name(mode):
+    return f"vga_{mode.visible_width}x{mode.visible_height}_{mode.frame_rate_hz:.0f}"
+
+
 def print_all(
     mode, h_divisor=1, out_instr="out pins, 2", cycles_per_pixel=6, file=sys.stdout
 ):
-    program_name = (
-        f"vga_{mode.visible_width}x{mode.visible_height}_{mode.frame_rate_hz:.0f}"
-    )
-    print_pio_hsync_program(program_name, mode, h_divisor, cycles_per_pixel, file=file)
+    name = program_name(mode)
+    print_pio_hsync_program(name, mode, h_divisor, cycles_per_pixel, file=file)
     print("\n\n\n", file=file)
-    print_pio_vsync_program(program_name, mode, cycles_per_pixel, file=file)
+    print_pio_vsync_program(name, mode, cycles_per_pixel, file=file)
     print("\n\n\n", file=file)
-    print_pio_pixel_program(program_name, mode, out_instr, cycles_per_pixel, file=file)
+    print_pio_pixel_program(name, mode, out_instr, cycles_per_pixel, file=file)
+
+
+def print_mode_table(modes, cycles_per_pixel=6, file=sys.stdout):
+    print(
+        f"""// Generated by vgamode.py, do not edit
+#pragma once
+
+// The modes in vga_modes.pio, for the firmware to switch between. Only one
+// mode's programs fit in a PIO's instruction memory at a time.
+typedef struct {{
+    const char *name;
+    uint32_t sys_clock_khz;
+    // system clock cycles per line, including horizontal blanking
+    uint32_t line_cycles;
+    uint16_t visible_width, visible_height;
+    const pio_program_t *hsync_program, *vsync_program, *pixel_program;
+    void (*hsync_init)(PIO pio, uint sm, uint offset, uint pin);
+    void (*vsync_init)(PIO pio, uint sm, uint offset, uint pin);
+    void (*pixel_init)(PIO pio, uint sm, uint offset, uint pin, uint n_pin);
+}} video_mode_t;
+
+static const video_mode_t video_modes[] = {{""",
+        file=file,
+    )
+    for mode in modes:
+        name = program_name(mode)
+        print(
+            f"""    {{"{mode.visible_width}x{mode.visible_height}@{mode.frame_rate_hz:.0f}", {cycles_per_pixel * mode.pixel_clock_khz}, {cycles_per_pixel * mode.total_width},
+     {mode.visible_width}, {mode.visible_height},
+     &{name}_hsync_program,
+     &{name}_vsync_program,
+     &{name}_pixel_program,
+     {name}_hsync_program_init, {name}_vsync_program_init,
+     {name}_pixel_program_init}},""",
+            file=file,
+        )
+    print(
+        f"""}};
+#define VIDEO_MODES ({len(modes)})
+#define VIDEO_MAX_HEIGHT ({max(mode.visible_height for mode in modes)})
+#define VIDEO_VBLANK_IRQ ({VBLANK_IRQ})""",
+        file=file,
+    )
 
 
-with open("vga_660x477_60.pio", "wt", encoding="utf-8") as f:
-    print_all(mode_vga_660x477, file=f)
+# The modes the firmware switches between (CTRL+ALT+F4), starting in the
+# first. The scanline kernels (mkscan.py) draw 660 pixels, and the text is 9
+# lines per row.
+modes = [
+    mode_vga_660x477,
+    # 70Hz, for monitors that sync to 400-line modes more sharply
+    change_visible_height(mode_vga_660x400, 396),
+]
+for mode in modes:
+    assert mode.visible_width == 660, mode
+    assert mode.visible_height % 9 == 0, mode
+
+with open("vga_modes.pio", "wt", encoding="utf-8") as f:
+    for mode in modes:
+        print_all(mode, file=f)
+with open("vga_modes.h", "wt", encoding="utf-8") as f:
+    print_mode_table(modes, file=f)